@@ -15,135 +15,202 @@ without written permission from Valve LLC.
 */
 
 #include "studio.h"
+#include "animation.h"
 
-static void decomp_calcbonevalue (
-    FILE *seqgroup,
-    int frame,
-    float* out,
-    float scale,
-    int animindex)
+/* Decoding state for one compressed animation channel, carried from frame to frame. */
+typedef struct
 {
-    mstudioanimvalue_t value;
-    mdl_seek (seqgroup, animindex, SEEK_SET);
-    mdl_read (seqgroup, &value, sizeof (value));
+    int offset; /* Offset of the current run, 0 if the channel is unused. */
+    int frame;  /* Frame within the current run. */
+    const mstudioanimvalue_t *run; /* Run header followed by its valid values. */
+} animcursor_t;
 
-    while (value.num.total <= frame)
-    {
-        frame -= value.num.total;
-        animindex += sizeof (value) * (value.num.valid + 1);
-        mdl_seek (seqgroup, animindex, SEEK_SET);
-        mdl_read (seqgroup, &value, sizeof (value));
-    }
+static void decomp_loadrun (mdlfile_t *seqgroup, animcursor_t *cursor)
+{
+    /* Bounds check the header before trusting its length. */
+    cursor->run = (const mstudioanimvalue_t *)mdl_ptr (seqgroup, cursor->offset, sizeof (*cursor->run));
+    cursor->run = (const mstudioanimvalue_t *)mdl_ptr (
+        seqgroup,
+        cursor->offset,
+        sizeof (*cursor->run) * (cursor->run[0].num.valid + 1));
+}
+
+static void decomp_initcursor (mdlfile_t *seqgroup, animcursor_t *cursor, int animindex, int offset)
+{
+    cursor->frame = 0;
+    cursor->offset = 0;
+
+    if (offset == 0)
+        return;
     
-    if (value.num.valid > frame)
-    {
-        mdl_seek (seqgroup, animindex + sizeof (value) * (frame + 1), SEEK_SET);
-    }
-    else
+    cursor->offset = animindex + offset;
+    decomp_loadrun (seqgroup, cursor);
+}
+
+/* Expand one channel's runs into its plane, one value every numbones floats. */
+static void decomp_decodechannel (
+    mdlfile_t *seqgroup,
+    animcursor_t *cursor,
+    float *out,
+    int numframes,
+    int numbones)
+{
+    int i, valid, frame;
+
+    for (i = 0; i < numframes; ++i)
     {
-        mdl_seek (seqgroup, animindex + sizeof (value) * value.num.valid, SEEK_SET);
-    }
+        while (cursor->run[0].num.total <= cursor->frame)
+        {
+            cursor->frame -= cursor->run[0].num.total;
+            cursor->offset += sizeof (*cursor->run) * (cursor->run[0].num.valid + 1);
+            decomp_loadrun (seqgroup, cursor);
+        }
+
+        valid = cursor->run[0].num.valid;
+        frame = cursor->frame++;
 
-    mdl_read (seqgroup, &value, sizeof (value));
-    *out += value.value * scale;
+        /* Frames past the valid values repeat the last one. */
+        out[i * numbones] = cursor->run[frame < valid ? frame + 1 : valid].value;
+    }
 }
 
-static void decomp_calcbone (
-    FILE *seqgroup,
-    int frame,
-    mstudiobone_t *bone,
-    mstudioanim_t *anim,
-    vec3_t bone_pos,
-    vec3_t bone_rot,
+void decomp_decodeanim (
+    mdlfile_t *seqgroup,
+    animpose_t *pose,
+    const mstudiobone_t *bones,
+    int numframes,
+    int numbones,
     int animindex)
 {
-    int i;
-    
-    for (i = 0; i < 3; ++i)
+    int i, j, k;
+    size_t at;
+    size_t count = (size_t)numframes * numbones;
+    const mstudioanim_t *anim = (const mstudioanim_t *)mdl_ptr (seqgroup, animindex, sizeof (*anim) * numbones);
+    animcursor_t cursor;
+
+    pose->numframes = numframes;
+    pose->numbones = numbones;
+    pose->values = (float *)scratch_alloc (count > 0 ? count * 6 : 1, sizeof (*pose->values));
+
+    scratchmark_t mark = scratch_mark ();
+    float *scale = (float *)scratch_alloc (numbones > 0 ? numbones * 6 : 1, sizeof (*scale));
+    float *base = (float *)scratch_alloc (numbones > 0 ? numbones * 6 : 1, sizeof (*base));
+
+    /* Raw values first, each channel's runs are walked once. */
+    for (j = 0; j < numbones; ++j)
     {
-        bone_pos[i] = bone->value[i];
-        bone_rot[i] = bone->value[3 + i];
-        
-        if (anim->offset[i] != 0)
+        for (i = 0; i < 6; ++i)
         {
-            decomp_calcbonevalue (
-                seqgroup,
-                frame,
-                &bone_pos[i],
-                bone->scale[i],
-                animindex + anim->offset[i]);
+            base[i * numbones + j] = bones[j].value[i];
+            scale[i * numbones + j] = bones[j].scale[i];
+
+            if (anim[j].offset[i] == 0)
+            {
+                /*
+                    The raw value is 0, and 0 * -0 is -0, which
+                    leaves every base untouched, even a negative zero.
+                */
+                scale[i * numbones + j] = -0.0F;
+
+                for (k = 0, at = j; k < numframes; ++k, at += numbones)
+                {
+                    ANIMPOSE_PLANE (pose, i)[at] = 0.0F;
+                }
+                continue;
+            }
+
+            decomp_initcursor (seqgroup, &cursor, animindex + sizeof (*anim) * j, anim[j].offset[i]);
+            decomp_decodechannel (seqgroup, &cursor, ANIMPOSE_PLANE (pose, i) + j, numframes, numbones);
+        }
+    }
+
+    /* Dequantize, a frame of a plane at a time. */
+    for (i = 0; i < 6; ++i)
+    {
+        float *plane = ANIMPOSE_PLANE (pose, i);
+        const float *s = scale + i * numbones;
+        const float *b = base + i * numbones;
+
+        for (k = 0; k < numframes; ++k)
+        {
+            float *row = plane + (size_t)k * numbones;
+
+            for (j = 0; j < numbones; ++j)
+            {
+                row[j] = row[j] * s[j] + b[j];
+            }
         }
+    }
+
+    /* Root bones are rotated into the SMD's frame. */
+    float *posx = ANIMPOSE_PLANE (pose, 0);
+    float *posy = ANIMPOSE_PLANE (pose, 1);
+    float *rotz = ANIMPOSE_PLANE (pose, 5);
+    float save;
+
+    for (j = 0; j < numbones; ++j)
+    {
+        if (bones[j].parent != -1)
+            continue;
         
-        if (anim->offset[3 + i] != 0)
+        for (k = 0, at = j; k < numframes; ++k, at += numbones)
         {
-            decomp_calcbonevalue (
-                seqgroup,
-                frame,
-                &bone_rot[i],
-                bone->scale[3 + i],
-                animindex + anim->offset[3 + i]);
+            save = posx[at];
+            posx[at] = posy[at];
+            posy[at] = -save;
+
+            rotz[at] -= Q_PI / 2.0F;
         }
     }
+
+    scratch_release (mark);
 }
 
 void decomp_studioanim (
-    FILE *seqgroup,
-    FILE *smd,
-    mstudiobone_t *bones,
+    mdlfile_t *seqgroup,
+    smdfile_t *smd,
+    const mstudiobone_t *bones,
     int numframes,
     int numbones,
     int animindex,
     const char *nodes)
 {
-    vec3_t *bone_pos = (vec3_t *)memalloc (numbones, sizeof (*bone_pos));
-    vec3_t *bone_rot = (vec3_t *)memalloc (numbones, sizeof (*bone_rot));
+    animpose_t pose;
+    vec3_t pos, rot;
+    size_t at;
+    int i, j, k;
 
-    qc_write (smd, "version 1");
-    qc_write (smd, nodes);
+    scratchmark_t mark = scratch_mark ();
 
-    int i, j;
-    mstudioanim_t anim;
-    
-    qc_write (smd, "skeleton");
+    trace_begin ("decode", "decode");
+    decomp_decodeanim (seqgroup, &pose, bones, numframes, numbones, animindex);
+    trace_end ();
 
-    for (i = 0; i < numframes; ++i)
+    STATS_COUNT (STATS_FRAMES, numframes);
+    trace_begin ("write", "write");
+
+    smd_write (smd, "version 1");
+    smd_write (smd, nodes);
+    smd_write (smd, "skeleton");
+
+    for (i = 0, at = 0; i < numframes; ++i)
     {
-        qc_writef (smd, "  time %i", i);
+        smd_writetime (smd, i);
 
-        for (j = 0; j < numbones; ++j)
+        for (j = 0; j < numbones; ++j, ++at)
         {
-            mdl_seek (seqgroup, animindex + sizeof (anim) * j, SEEK_SET);
-            mdl_read (seqgroup, &anim, sizeof (anim));
-
-            decomp_calcbone (
-                seqgroup,
-                i,
-                bones + j,
-                &anim,
-                bone_pos[j],
-                bone_rot[j],
-                animindex + sizeof (anim) * j);
-            
-            if (bones[j].parent == -1)
+            for (k = 0; k < 3; ++k)
             {
-                float save = bone_pos[j][0];
-                bone_pos[j][0] = bone_pos[j][1];
-                bone_pos[j][1] = -save;
-
-                bone_rot[j][2] -= Q_PI / 2.0F;
+                pos[k] = ANIMPOSE_PLANE (&pose, k)[at];
+                rot[k] = ANIMPOSE_PLANE (&pose, 3 + k)[at];
             }
 
-            qc_writef (
-                smd,
-                "    %i %.06f %.06f %.06f %.06f %.06f %.06f",
-                j,
-                vec3_print (bone_pos[j]),
-                vec3_print (bone_rot[j]));
+            smd_writebone (smd, j, pos, rot);
         }
     }
     
-    qc_write (smd, "end");
+    smd_write (smd, "end");
+    trace_end ();
     
-    free (bone_rot);
-    free (bone_pos);
+    scratch_release (mark);
 }
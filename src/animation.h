@@ -0,0 +1,44 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#ifndef _ANIMATION_H
+#define _ANIMATION_H
+
+#include "studio.h"
+
+/*
+    A decoded sequence blend. Each of the 6 channels (position xyz, rotation xyz)
+    gets its own plane of numframes * numbones values, bones varying fastest.
+    The values are scratch memory, freed by the caller's scratch_release.
+*/
+typedef struct
+{
+	int numframes;
+	int numbones;
+	float *values;
+} animpose_t;
+
+#define ANIMPOSE_PLANE(pose, channel) ((pose)->values + (size_t)(channel) * (pose)->numframes * (pose)->numbones)
+
+void decomp_decodeanim (
+	mdlfile_t *seqgroup,
+	animpose_t *pose,
+	const mstudiobone_t *bones,
+	int numframes,
+	int numbones,
+	int animindex);
+
+#endif /* _ANIMATION_H */
@@ -0,0 +1,382 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <glob.h>
+#endif
+#include <sys/stat.h>
+
+#include "studio.h"
+
+typedef struct
+{
+    batchfile_t *files;
+    int count;
+    int max;
+} batchlist_t;
+
+static bool batch_isdir (const char *path)
+{
+    struct stat st;
+    return stat (path, &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+static bool batch_isfile (const char *path)
+{
+    struct stat st;
+    return stat (path, &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG;
+}
+
+bool batch_isinput (const char *path)
+{
+    char *name, *ext;
+    filebase (path, &name, &ext);
+
+    return !strcasecmp (ext, ".mdl")
+        || !strcasecmp (ext, ".spr")
+        || !strcasecmp (ext, ".wad")
+        || !strcasecmp (ext, ".bsp");
+}
+
+static bool batch_iswildcard (const char *path)
+{
+    return strpbrk (path, "*?[") != NULL;
+}
+
+/* Whether the file's header is a T.mdl's textures, or a sequence group's if seqgroup is set. */
+static bool batch_iscompaniondata (const char *path, bool seqgroup)
+{
+    FILE *stream = fopen (path, "rb");
+    studiohdr_t header;
+
+    if (!stream)
+        return false;
+
+    size_t got = fread (&header, 1, sizeof (header), stream);
+
+    fclose (stream);
+
+    if (got < sizeof (header.id))
+        return false;
+
+    if (seqgroup)
+        return header.id == IDSTUDIOSEQHEADER;
+
+    return got == sizeof (header) && header.id == IDSTUDIOHEADER && header.numbones == 0;
+}
+
+/* True for "fooT.mdl" and "foo01.mdl" if "foo.mdl" sits next to them, and they are what their names say. */
+static bool batch_iscompanion (const char *path)
+{
+    char *name, *ext;
+    filebase (path, &name, &ext);
+
+    if (strcasecmp (ext, ".mdl"))
+        return false;
+
+    int suffix = 0;
+
+    if (ext - name > 1 && (ext[-1] == 't' || ext[-1] == 'T'))
+    {
+        suffix = 1;
+    }
+    else if (ext - name > 2 && isdigit (ext[-1]) && isdigit (ext[-2]))
+    {
+        suffix = 2;
+    }
+
+    if (suffix == 0)
+        return false;
+    
+    size_t len = (ext - path) - suffix;
+    char *base = (char *)memalloc (len + strlen (ext) + 1, 1);
+
+    memcpy (base, path, len);
+    strcat (base, ext);
+
+    bool found = batch_isfile (base);
+
+    free (base);
+    return found && batch_iscompaniondata (path, suffix == 2);
+}
+
+/* With a trailing slash, so decomp_path never takes a dotted one like "v1.5" for a QC name. */
+static char *batch_outdir (const char *outdir)
+{
+    size_t len = strlen (outdir);
+    char *copy = (char *)memalloc (len + 2, 1);
+
+    memcpy (copy, outdir, len);
+
+    if (len == 0 || (outdir[len - 1] != '/' && outdir[len - 1] != '\\'))
+        copy[len] = '/';
+
+    return copy;
+}
+
+static void batch_add (batchlist_t *list, const char *path, const char *outdir)
+{
+    if (batch_iscompanion (path))
+        return;
+    
+    if (list->count == list->max)
+    {
+        list->max = list->max ? list->max * 2 : 64;
+        list->files = (batchfile_t *)realloc (list->files, list->max * sizeof (*list->files));
+
+        if (!list->files)
+            error (1, "Failed to allocate %i bytes\n", list->max * sizeof (*list->files));
+    }
+
+    list->files[list->count].path = strdup (path);
+    list->files[list->count].outdir = outdir ? batch_outdir (outdir) : NULL;
+    list->count++;
+}
+
+static void batch_walk (batchlist_t *list, const char *dir, const char *rel);
+
+static void batch_entry (batchlist_t *list, const char *dir, const char *rel, const char *entry)
+{
+    if (!strcmp (entry, ".") || !strcmp (entry, ".."))
+        return;
+    
+    char *path = appenddir (dir, entry);
+
+    if (batch_isdir (path))
+    {
+        char *sub = rel ? appenddir (rel, entry) : strdup (entry);
+        batch_walk (list, path, sub);
+        free (sub);
+    }
+    else if (batch_isinput (path))
+    {
+        batch_add (list, path, rel);
+    }
+
+    free (path);
+}
+
+/* Recurse into a directory, keeping the sub directories for the output. */
+static void batch_walk (batchlist_t *list, const char *dir, const char *rel)
+{
+#ifdef _WIN32
+    char *pattern = appenddir (dir, "*");
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA (pattern, &data);
+
+    free (pattern);
+
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        msg_warning ("Warning: Can't open directory \"%s\"\n", dir);
+        return;
+    }
+    
+    do
+    {
+        batch_entry (list, dir, rel, data.cFileName);
+    }
+    while (FindNextFileA (find, &data));
+
+    FindClose (find);
+#else
+    DIR *d = opendir (dir);
+    struct dirent *ent;
+
+    if (!d)
+    {
+        msg_warning ("Warning: Can't open directory \"%s\"\n", dir);
+        return;
+    }
+
+    while ((ent = readdir (d)) != NULL)
+    {
+        batch_entry (list, dir, rel, ent->d_name);
+    }
+
+    closedir (d);
+#endif
+}
+
+static void batch_match (batchlist_t *list, const char *path)
+{
+    if (batch_isdir (path))
+    {
+        batch_walk (list, path, NULL);
+    }
+    else if (batch_isinput (path))
+    {
+        batch_add (list, path, NULL);
+    }
+}
+
+static void batch_glob (batchlist_t *list, const char *pattern)
+{
+#ifdef _WIN32
+    /* Only the last path component may contain wildcards. */
+    char *dir = strdup (pattern);
+    char *name, *ext;
+    filebase (dir, &name, &ext);
+    *name = '\0';
+
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA (pattern, &data);
+
+    if (find != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if (!strcmp (data.cFileName, ".") || !strcmp (data.cFileName, ".."))
+                continue;
+
+            char *path = (char *)memalloc (strlen (dir) + strlen (data.cFileName) + 1, 1);
+            strcpy (path, dir);
+            strcat (path, data.cFileName);
+            batch_match (list, path);
+            free (path);
+        }
+        while (FindNextFileA (find, &data));
+
+        FindClose (find);
+    }
+
+    free (dir);
+#else
+    glob_t g;
+    size_t i;
+
+    if (glob (pattern, 0, NULL, &g) != 0)
+        return;
+    
+    for (i = 0; i < g.gl_pathc; ++i)
+    {
+        batch_match (list, g.gl_pathv[i]);
+    }
+
+    globfree (&g);
+#endif
+}
+
+static void batch_source (batchlist_t *list, const char *source, bool listfile);
+
+/* One path, directory or pattern per line. Blank lines and "#" comments are skipped. */
+static void batch_listfile (batchlist_t *list, const char *filename)
+{
+    FILE *stream = fopen (filename, "r");
+    char line[1024];
+
+    if (!stream)
+    {
+        msg_warning ("Warning: Can't open list file \"%s\"\n", filename);
+        return;
+    }
+
+    while (fgets (line, sizeof (line), stream))
+    {
+        line[strcspn (line, "\r\n")] = '\0';
+
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+        
+        batch_source (list, line, false);
+    }
+
+    fclose (stream);
+}
+
+static void batch_source (batchlist_t *list, const char *source, bool listfile)
+{
+    if (batch_isdir (source))
+    {
+        batch_walk (list, source, NULL);
+    }
+    else if (batch_iswildcard (source))
+    {
+        batch_glob (list, source);
+    }
+    else if (batch_isinput (source))
+    {
+        batch_add (list, source, NULL);
+    }
+    else if (listfile && batch_isfile (source))
+    {
+        batch_listfile (list, source);
+    }
+    else
+    {
+        msg_warning ("Warning: Skipping \"%s\"\n", source);
+    }
+}
+
+static int batch_compare (const void *a, const void *b)
+{
+    const batchfile_t *file1 = (const batchfile_t *)a;
+    const batchfile_t *file2 = (const batchfile_t *)b;
+    int cmp = strcmp (file1->path, file2->path);
+
+    if (cmp != 0)
+        return cmp;
+    
+    /* Keep the same duplicate every time. */
+    if (!file1->outdir || !file2->outdir)
+        return (file1->outdir != NULL) - (file2->outdir != NULL);
+
+    return strcmp (file1->outdir, file2->outdir);
+}
+
+batchfile_t *batch_collect (char **sources, int numsources, int *numfiles)
+{
+    batchlist_t list = {NULL, 0, 0};
+    int i, j;
+
+    for (i = 0; i < numsources; ++i)
+    {
+        batch_source (&list, sources[i], true);
+    }
+
+    /* Directory order is arbitrary, and sources may overlap. */
+    qsort (list.files, list.count, sizeof (*list.files), batch_compare);
+
+    for (i = 0, j = 0; i < list.count; ++i)
+    {
+        if (j > 0 && !strcmp (list.files[j - 1].path, list.files[i].path))
+        {
+            free (list.files[i].path);
+            free (list.files[i].outdir);
+            continue;
+        }
+        list.files[j++] = list.files[i];
+    }
+
+    *numfiles = j;
+    return list.files;
+}
+
+void batch_free (batchfile_t *files, int numfiles)
+{
+    int i;
+
+    for (i = 0; i < numfiles; ++i)
+    {
+        free (files[i].path);
+        free (files[i].outdir);
+    }
+
+    free (files);
+}
@@ -21,10 +21,18 @@ without written permission from Valve LLC.
 #ifdef _WIN32
 #include <windows.h>
 #include <direct.h>
+#else
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
 #endif
 #include <errno.h>
+#include <setjmp.h>
 
 #include "studio.h"
+#include "thread.h"
 #include "activity.h"
 #include "activitymap.h"
 
@@ -34,16 +42,444 @@ without written permission from Valve LLC.
 #define SLASH '/'
 #endif
 
+/* Files opened by a job, so they can be closed if it aborts. */
+typedef struct jobfile_s
+{
+    void *handle;
+    bool input;
+    struct jobfile_s *next;
+} jobfile_t;
+
+typedef struct
+{
+    jmp_buf abort;
+    jobfile_t *files;
+} job_t;
+
+static void qc_abort (qcfile_t *stream);
+
+/* Each thread runs its own jobs. */
+static THREADLOCAL job_t *curjob = NULL;
+
+/* Where this thread's console output goes, the console if NULL. */
+static THREADLOCAL msgbuf_t *curmsg = NULL;
+
+/* The decomp_buffer call this thread works for, the disk if NULL. */
+static THREADLOCAL iocontext_t *curio = NULL;
+
+/* Fed what's written to the next output this thread opens, see qc_hashnext. */
+static THREADLOCAL uint64_t *nexthash = NULL;
+
+/* Returns the previous one. */
+iocontext_t *io_set (iocontext_t *ctx)
+{
+    iocontext_t *prev = curio;
+    curio = ctx;
+    return prev;
+}
+
+iocontext_t *io_get (void)
+{
+    return curio;
+}
+
+/* Tells decomp_path's report about a file written on disk. */
+void io_output (const char *path)
+{
+    if (curio && curio->report && curio->report->output)
+        curio->report->output (curio->report->user, path);
+}
+
+static int msg_level = MSG_NORMAL;
+
+void msg_setlevel (int level)
+{
+    msg_level = level;
+}
+
+/*
+    Once started, console output is handed to a logger thread instead of being
+    written on the spot. Messages are pushed on a lock-free stack, which the
+    logger takes whole and writes out oldest first. Producers only touch the
+    lock when the stack was empty, to wake the logger.
+*/
+typedef struct msgnode_s
+{
+    struct msgnode_s *next;
+    FILE *stream;
+    size_t len;
+    char text[];
+} msgnode_t;
+
+static void *volatile msg_stack = NULL;
+static bool msg_running = false;
+static bool msg_quit = false;
+static mutex_t msg_lock = MUTEX_INIT;
+static cond_t msg_wake;
+static thread_t msg_thread;
+
+static void msg_write (msgnode_t *node)
+{
+    msgnode_t *next;
+    msgnode_t *prev = NULL;
+
+    /* Newest first on the stack, turn it around. */
+    for (; node; node = next)
+    {
+        next = node->next;
+        node->next = prev;
+        prev = node;
+    }
+
+    for (node = prev; node; node = next)
+    {
+        next = node->next;
+
+        /* stderr isn't buffered, don't let it overtake what's before it. */
+        if (node->stream == stderr)
+            fflush (stdout);
+
+        fwrite (node->text, 1, node->len, node->stream);
+        free (node);
+    }
+
+    fflush (stdout);
+    fflush (stderr);
+}
+
+static void msg_logger (void *arg)
+{
+    msgnode_t *batch;
+    bool quit;
+
+    (void)arg;
+
+    while (true)
+    {
+        mutex_lock (&msg_lock);
+
+        while (!msg_quit && !atomic_loadptr (&msg_stack))
+            cond_wait (&msg_wake, &msg_lock);
+
+        quit = msg_quit;
+
+        mutex_unlock (&msg_lock);
+
+        batch = (msgnode_t *)atomic_xchgptr (&msg_stack, NULL);
+
+        if (!batch && quit)
+            break;
+
+        msg_write (batch);
+    }
+}
+
+/* decomp_buffer's messages, or decomp_path's with a report, go to the caller instead. */
+static void msg_vsend (int level, int len, const char *fmt, va_list va)
+{
+    void (*message) (void *, int, const char *) = curio->io ? curio->io->message : curio->report->message;
+    void *user = curio->io ? curio->io->user : curio->report->user;
+    char buf[1024];
+    char *text = buf;
+
+    if (!message)
+        return;
+
+    if (len >= (int)sizeof (buf))
+    {
+        text = (char *)malloc (len + 1);
+
+        if (!text)
+            return;
+    }
+
+    vsnprintf (text, len + 1, fmt, va);
+    message (user, level, text);
+
+    if (text != buf)
+        free (text);
+}
+
+/* The caller formats straight into the node, nothing is shared until the push. */
+static void msg_vpush (int level, const char *fmt, va_list va)
+{
+    FILE *stream = level >= DECOMP_MSG_WARNING ? stderr : stdout;
+    va_list copy;
+
+    va_copy (copy, va);
+    int len = vsnprintf (NULL, 0, fmt, copy);
+    va_end (copy);
+
+    if (len <= 0)
+        return;
+
+    if (curio)
+    {
+        msg_vsend (level, len, fmt, va);
+        return;
+    }
+
+    if (!msg_running)
+    {
+        vfprintf (stream, fmt, va);
+        return;
+    }
+
+    msgnode_t *node = (msgnode_t *)malloc (sizeof (*node) + len + 1);
+
+    if (!node)
+    {
+        vfprintf (stream, fmt, va);
+        return;
+    }
+
+    node->stream = stream;
+    node->len = len;
+    vsnprintf (node->text, len + 1, fmt, va);
+
+    void *head;
+
+    do
+    {
+        head = atomic_loadptr (&msg_stack);
+        node->next = (msgnode_t *)head;
+    }
+    while (!atomic_casptr (&msg_stack, head, node));
+
+    if (!head)
+    {
+        mutex_lock (&msg_lock);
+        cond_signal (&msg_wake);
+        mutex_unlock (&msg_lock);
+    }
+}
+
+static void msg_push (int level, const char *fmt, ...)
+{
+    va_list va;
+    va_start (va, fmt);
+    msg_vpush (level, fmt, va);
+    va_end (va);
+}
+
+void msg_start (void)
+{
+    static bool registered = false;
+
+    if (msg_running)
+        return;
+
+    cond_init (&msg_wake);
+    msg_quit = false;
+    msg_running = true;
+    thread_create (&msg_thread, msg_logger, NULL);
+
+    /* error () may exit from anywhere, what's queued still goes out. */
+    if (!registered)
+    {
+        atexit (msg_stop);
+        registered = true;
+    }
+}
+
+void msg_stop (void)
+{
+    if (!msg_running)
+        return;
+
+    mutex_lock (&msg_lock);
+    msg_quit = true;
+    cond_broadcast (&msg_wake);
+    mutex_unlock (&msg_lock);
+
+    thread_join (msg_thread);
+    cond_destroy (&msg_wake);
+
+    msg_running = false;
+    msg_write ((msgnode_t *)atomic_xchgptr (&msg_stack, NULL));
+}
+
+static void msg_vprintf (int level, const char *fmt, va_list va)
+{
+    va_list copy;
+
+    if (!curmsg)
+    {
+        msg_vpush (level, fmt, va);
+        return;
+    }
+
+    va_copy (copy, va);
+    int len = vsnprintf (NULL, 0, fmt, copy);
+    va_end (copy);
+
+    if (len <= 0)
+        return;
+
+    if (curmsg->len + len + 1 > curmsg->max)
+    {
+        curmsg->max = (curmsg->len + len + 1) * 2;
+        curmsg->data = (char *)realloc (curmsg->data, curmsg->max);
+
+        if (!curmsg->data)
+            error (1, "Failed to allocate %i bytes\n", curmsg->max);
+    }
+
+    vsnprintf (curmsg->data + curmsg->len, len + 1, fmt, va);
+
+    curmsg->len += len;
+}
+
+/* Always printed, results & summaries. */
+void msg_printf (const char *fmt, ...)
+{
+    va_list va;
+    va_start (va, fmt);
+    msg_vprintf (MSG_QUIET, fmt, va);
+    va_end (va);
+}
+
+/* Printed if the -q/-v level allows. */
+void msg_log (int level, const char *fmt, ...)
+{
+    va_list va;
+
+    if (level > msg_level)
+        return;
+
+    va_start (va, fmt);
+    msg_vprintf (level, fmt, va);
+    va_end (va);
+}
+
+/* Straight to stderr, in order with the rest of the output. */
+void msg_warning (const char *fmt, ...)
+{
+    va_list va;
+    va_start (va, fmt);
+    msg_vpush (DECOMP_MSG_WARNING, fmt, va);
+    va_end (va);
+}
+
+/* Send this thread's output to buf, or back to stdout if NULL. Returns the previous one. */
+msgbuf_t *msg_capture (msgbuf_t *buf)
+{
+    msgbuf_t *prev = curmsg;
+    curmsg = buf;
+    return prev;
+}
+
+/* Print what buf captured, into the current capture if there is one, and empty it. */
+void msg_flush (msgbuf_t *buf)
+{
+    if (buf->len > 0)
+    {
+        if (curmsg)
+            msg_printf ("%.*s", (int)buf->len, buf->data);
+        else
+            msg_push (MSG_NORMAL, "%.*s", (int)buf->len, buf->data);
+    }
+
+    free (buf->data);
+    buf->data = NULL;
+    buf->len = 0;
+    buf->max = 0;
+}
+
 void error (int code, const char *fmt, ...)
 {
     va_list va;
     va_start (va, fmt);
-    vfprintf (stderr, fmt, va);
+    msg_vpush (DECOMP_MSG_ERROR, fmt, va);
     va_end (va);
+
+    if (curjob)
+        longjmp (curjob->abort, code != 0 ? code : 1);
+
     exit (code);
 }
 
-static bool isslash (char *c)
+static void job_track (void *handle, bool input)
+{
+    if (!curjob)
+        return;
+
+    jobfile_t *file = (jobfile_t *)memalloc (1, sizeof (*file));
+    file->handle = handle;
+    file->input = input;
+    file->next = curjob->files;
+    curjob->files = file;
+}
+
+static void job_untrack (void *handle)
+{
+    if (!curjob)
+        return;
+
+    jobfile_t **link = &curjob->files;
+
+    while (*link)
+    {
+        jobfile_t *file = *link;
+
+        if (file->handle == handle)
+        {
+            *link = file->next;
+            free (file);
+            return;
+        }
+        link = &file->next;
+    }
+}
+
+int job_run (void (*func) (void *), void *arg)
+{
+    /* Allocated so it survives the longjmp intact. */
+    job_t *job = (job_t *)memalloc (1, sizeof (*job));
+    job_t *prev = curjob;
+    msgbuf_t *prevmsg = curmsg;
+    statsphase_t phase = stats_phase ();
+    int depth = trace_depth ();
+    scratchmark_t mark = scratch_mark ();
+    int code = setjmp (job->abort);
+
+    if (code == 0)
+    {
+        curjob = job;
+        func (arg);
+    }
+    else
+    {
+        jobfile_t *file = job->files;
+        jobfile_t *next;
+
+        job->files = NULL;
+
+        while (file)
+        {
+            next = file->next;
+            if (file->input)
+                mdl_close ((mdlfile_t *)file->handle);
+            else
+                qc_abort ((qcfile_t *)file->handle);
+            free (file);
+            file = next;
+        }
+
+        nexthash = NULL;
+    }
+
+    curjob = prev;
+    curmsg = prevmsg;
+    stats_end (phase);
+    trace_unwind (depth);
+    scratch_release (mark);
+    free (job);
+
+    return code;
+}
+
+static bool isslash (const char *c)
 {
     return c[0] == '/'
         || c[0] == '\\';
@@ -132,14 +568,17 @@ void stripfilename (char *str)
     }
 }
 
-char *appenddir (char *path, char *dir)
+static size_t appenddir_size (const char *path, const char *dir)
+{
+    return strlen (path) + 1 + strlen (dir) + 1;
+}
+
+static char *appenddir_to (char *new_path, const char *path, const char *dir)
 {
     size_t path_len = strlen (path);
-    size_t dir_len = strlen (dir);
 
     bool need_slash = !isslash (path + (path_len - 1));
 
-    char *new_path = (char *)memalloc (path_len + need_slash + dir_len + 1, 1);
     strcpy (new_path, path);
 
     if (need_slash)
@@ -153,6 +592,17 @@ char *appenddir (char *path, char *dir)
     return new_path;
 }
 
+char *appenddir (char *path, char *dir)
+{
+    return appenddir_to ((char *)memalloc (appenddir_size (path, dir), 1), path, dir);
+}
+
+/* The same in the scratch arena, for paths a job may abort holding. */
+char *scratch_appenddir (const char *path, const char *dir)
+{
+    return appenddir_to ((char *)scratch_alloc (appenddir_size (path, dir), 1), path, dir);
+}
+
 void filebase (char *str, char **name, char **ext)
 {
     char *c = str;
@@ -189,95 +639,601 @@ static bool makedir (const char *path)
     return errno == EEXIST;
 }
 
-bool makepath (const char *path)
+/*
+    Directories made (or found) so far, shared by every thread, so each one
+    costs a single mkdir per run instead of one per file written under it.
+*/
+typedef struct
 {
-    char *c = path;
-    char slash;
+    uint64_t hash;
+    char *path; /* NULL if the slot is free. */
+} direntry_t;
 
-    while (*c)
+static mutex_t dir_lock = MUTEX_INIT;
+static direntry_t *dir_entries = NULL;
+static size_t dir_count = 0;
+static size_t dir_max = 0; /* Always a power of 2. */
+
+static direntry_t *dir_find (direntry_t *entries, size_t max, uint64_t hash, const char *path)
+{
+    size_t i = (size_t)hash & (max - 1);
+
+    while (entries[i].path)
     {
-        if (isslash (c))
-        {
-            slash = *c;
-            *c = '\0';
-            if (!makedir (path))
-            {
-                *c = slash;
-                return false;
-            }
-            *c = slash;
-        }
-        c++;
+        if (entries[i].hash == hash && !strcmp (entries[i].path, path))
+            break;
+        
+        i = (i + 1) & (max - 1);
     }
 
-    return true;
+    return &entries[i];
 }
 
-void *memalloc (size_t nmemb, size_t size)
+static bool dir_known (const char *path, uint64_t hash)
 {
-    void *ptr = calloc (nmemb, size);
+    bool known = false;
 
-    if (!ptr)
-        error (1, "Failed to allocate %i bytes\n", nmemb * size);
-    
-    return ptr;
+    mutex_lock (&dir_lock);
+
+    if (dir_max)
+        known = dir_find (dir_entries, dir_max, hash, path)->path != NULL;
+
+    mutex_unlock (&dir_lock);
+
+    return known;
 }
 
-FILE *mdl_open (const char *filename, int *identifier, int *version, int safe)
+static void dir_add (const char *path, uint64_t hash)
 {
-    if (!safe)
-        fprintf (stdout, "Reading from \"%s\"...\n", filename);
+    size_t i;
 
-    FILE *stream = fopen (filename, "rb");
+    mutex_lock (&dir_lock);
 
-    if (!stream)
+    if (dir_count * 2 >= dir_max)
     {
-        if (safe)
-            return NULL;
-        error (1, "No input file\n");
-    }
+        size_t max = dir_max ? dir_max * 2 : 256;
+        direntry_t *entries = (direntry_t *)memalloc (max, sizeof (*entries));
 
-    if (safe)
-        fprintf (stdout, "Reading from \"%s\"...\n", filename);
-    
-    if (identifier)
-    {
-        int32_t id;
-        mdl_read (stream, &id, sizeof (id));
-        *identifier = id;
+        for (i = 0; i < dir_max; ++i)
+        {
+            if (dir_entries[i].path)
+                *dir_find (entries, max, dir_entries[i].hash, dir_entries[i].path) = dir_entries[i];
+        }
+
+        free (dir_entries);
+        dir_entries = entries;
+        dir_max = max;
     }
 
-    if (version)
+    direntry_t *entry = dir_find (dir_entries, dir_max, hash, path);
+
+    if (!entry->path)
     {
-        int32_t v;
-        mdl_read (stream, &v, sizeof (v));
-        *version = v;
+        entry->hash = hash;
+        entry->path = strdup (path);
+        dir_count++;
     }
-    
-    mdl_seek (stream, 0, SEEK_SET);
-    
-    return stream;
-}
 
-void mdl_read (FILE *stream, void *dst, size_t size)
-{
-    if (fread (dst, 1, size, stream) < size)
-        error (1, "Read failed\n");
+    mutex_unlock (&dir_lock);
 }
 
-void mdl_seek (FILE *stream, long off, int whence)
+/* For when a directory made earlier may have been removed since. */
+static void dir_clear (void)
 {
-    if (fseek (stream, off, whence) < 0)
-        error (1, "Seek failed\n");
+    size_t i;
+
+    mutex_lock (&dir_lock);
+
+    for (i = 0; i < dir_max; ++i)
+    {
+        free (dir_entries[i].path);
+    }
+
+    free (dir_entries);
+    dir_entries = NULL;
+    dir_count = 0;
+    dir_max = 0;
+
+    mutex_unlock (&dir_lock);
 }
 
-char* mdl_getmotionflag (int type)
+bool makepath (const char *path)
 {
-    switch (type & STUDIO_TYPES)
-    {
-    case STUDIO_X: return "X";
-    case STUDIO_Y: return "Y";
-    case STUDIO_Z: return "Z";
+    uint64_t hash;
+
+    /* Usually the whole thing is known already. */
+    if (dir_known (path, hash64 (path, strlen (path), 0)))
+        return true;
+
+    char *copy = strdup (path);
+    char *c = copy;
+
+    while (*c)
+    {
+        /* A leading slash is the root, nothing to make. */
+        if (isslash (c) && c != copy)
+        {
+            char slash = *c;
+            *c = '\0';
+            hash = hash64 (copy, c - copy, 0);
+
+            if (!dir_known (copy, hash))
+            {
+                if (!makedir (copy))
+                {
+                    free (copy);
+                    return false;
+                }
+
+                dir_add (copy, hash);
+            }
+            *c = slash;
+        }
+        c++;
+    }
+
+    free (copy);
+    dir_add (path, hash64 (path, strlen (path), 0));
+
+    return true;
+}
+
+#ifdef _WIN32
+static int64_t file_stamptime (const FILETIME *time)
+{
+    return (int64_t)((((uint64_t)time->dwHighDateTime << 32) | time->dwLowDateTime) * 100);
+}
+#else
+static void file_stampstat (const struct stat *st, filestamp_t *stamp)
+{
+    stamp->size = (uint64_t)st->st_size;
+#ifdef __APPLE__
+    stamp->mtime = (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#else
+    stamp->mtime = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
+#endif
+
+/* False if the file isn't there. */
+bool file_stamp (const char *path, filestamp_t *stamp)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!GetFileAttributesExA (path, GetFileExInfoStandard, &data))
+        return false;
+
+    stamp->size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    stamp->mtime = file_stamptime (&data.ftLastWriteTime);
+#else
+    struct stat st;
+
+    if (stat (path, &st) != 0)
+        return false;
+
+    file_stampstat (&st, stamp);
+#endif
+
+    return true;
+}
+
+void *memalloc (size_t nmemb, size_t size)
+{
+    void *ptr = calloc (nmemb, size);
+
+    if (!ptr)
+        error (1, "Failed to allocate %i bytes\n", nmemb * size);
+    
+    return ptr;
+}
+
+/*
+    Each thread has a bump arena for buffers that only live while a texture,
+    mesh or blend is written. Blocks are kept once allocated, so after the
+    first file nothing goes through malloc. Every job gives back what it took,
+    even if it aborts, which resets the arena at the end of each file.
+*/
+
+#define SCRATCH_BLOCKSIZE (1 << 20)
+#define SCRATCH_ALIGN 16
+#define SCRATCH_HEADER ((sizeof (scratchblock_t) + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1))
+
+typedef struct scratchblock_s
+{
+    struct scratchblock_s *prev;
+    size_t size;
+    size_t used;
+    size_t base; /* Used in the blocks below this one. */
+} scratchblock_t;
+
+static THREADLOCAL scratchblock_t *scratch_top = NULL;
+static THREADLOCAL scratchblock_t *scratch_spare = NULL;
+static THREADLOCAL size_t scratch_peak = 0;
+
+/* Across all threads. */
+static volatile int32_t scratch_peakkib = 0;
+static volatile int32_t scratch_reservedkib = 0;
+
+static void scratch_grow (size_t size)
+{
+    scratchblock_t **link = &scratch_spare;
+    scratchblock_t *block;
+
+    while (*link && (*link)->size < size)
+    {
+        link = &(*link)->prev;
+    }
+
+    if (*link)
+    {
+        block = *link;
+        *link = block->prev;
+    }
+    else
+    {
+        size_t blocksize = size > SCRATCH_BLOCKSIZE ? size : SCRATCH_BLOCKSIZE;
+        block = (scratchblock_t *)malloc (SCRATCH_HEADER + blocksize);
+
+        if (!block)
+            error (1, "Failed to allocate %zu bytes\n", SCRATCH_HEADER + blocksize);
+
+        block->size = blocksize;
+        atomic_add32 (&scratch_reservedkib, (int32_t)(blocksize / 1024));
+    }
+
+    block->prev = scratch_top;
+    block->used = 0;
+    block->base = scratch_top ? scratch_top->base + scratch_top->used : 0;
+    scratch_top = block;
+}
+
+/* Not zeroed, unlike memalloc. Gone at the next scratch_release below it. */
+void *scratch_alloc (size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > ((size_t)-1 - SCRATCH_ALIGN) / size)
+        error (1, "Failed to allocate %zu * %zu bytes\n", nmemb, size);
+    
+    size_t bytes = (nmemb * size + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+
+    if (!scratch_top || scratch_top->size - scratch_top->used < bytes)
+        scratch_grow (bytes);
+    
+    void *ptr = (byte *)scratch_top + SCRATCH_HEADER + scratch_top->used;
+    scratch_top->used += bytes;
+
+    size_t usage = scratch_top->base + scratch_top->used;
+
+    if (usage > scratch_peak)
+    {
+        int32_t kib = (int32_t)((usage + 1023) / 1024);
+        int32_t old;
+
+        scratch_peak = usage;
+
+        while ((old = atomic_load32 (&scratch_peakkib)) < kib && !atomic_cas32 (&scratch_peakkib, old, kib))
+            ;
+    }
+
+    return ptr;
+}
+
+scratchmark_t scratch_mark (void)
+{
+    scratchmark_t mark;
+    mark.block = scratch_top;
+    mark.used = scratch_top ? scratch_top->used : 0;
+    return mark;
+}
+
+/* Frees everything allocated on this thread since the mark was taken. */
+void scratch_release (scratchmark_t mark)
+{
+    scratchblock_t *block;
+
+    while (scratch_top != mark.block)
+    {
+        block = scratch_top;
+        scratch_top = block->prev;
+        block->prev = scratch_spare;
+        scratch_spare = block;
+    }
+
+    if (scratch_top)
+        scratch_top->used = mark.used;
+}
+
+/* Hand this thread's blocks back to the system, for threads about to exit. */
+void scratch_shutdown (void)
+{
+    scratchmark_t empty = {NULL, 0};
+    scratchblock_t *block;
+
+    scratch_release (empty);
+
+    while (scratch_spare)
+    {
+        block = scratch_spare;
+        scratch_spare = block->prev;
+        atomic_add32 (&scratch_reservedkib, -(int32_t)(block->size / 1024));
+        free (block);
+    }
+}
+
+/* Largest arena any one thread used, and what all of them hold right now. */
+void scratch_stats (int *peakkib, int *reservedkib)
+{
+    *peakkib = atomic_load32 (&scratch_peakkib);
+    *reservedkib = atomic_load32 (&scratch_reservedkib);
+}
+
+#define HASH_PRIME1 0x9E3779B97F4A7C15ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+
+static uint64_t hash_rotl (uint64_t x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+static uint64_t hash_mix (uint64_t h, uint64_t k)
+{
+    k *= HASH_PRIME2;
+    k = hash_rotl (k, 31);
+    k *= HASH_PRIME1;
+    h ^= k;
+    return hash_rotl (h, 27) * HASH_PRIME1 + 0x52DCE729;
+}
+
+/* Fast non-cryptographic 64-bit hash, 8 bytes a step. Chain calls through seed. */
+uint64_t hash64 (const void *data, size_t size, uint64_t seed)
+{
+    const byte *ptr = (const byte *)data;
+    uint64_t h = seed ^ (size * HASH_PRIME1);
+    uint64_t k;
+
+    for (; size >= 8; size -= 8, ptr += 8)
+    {
+        memcpy (&k, ptr, sizeof (k));
+        h = hash_mix (h, k);
+    }
+
+    if (size > 0)
+    {
+        k = 0;
+        memcpy (&k, ptr, size);
+        h = hash_mix (h, k);
+    }
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+static bool mdl_load (mdlfile_t *mdl, const char *filename)
+{
+    /* Fallback for files that can't be mapped. */
+    FILE *stream = fopen (filename, "rb");
+
+    if (!stream)
+        return false;
+
+    byte *data = NULL;
+
+    if (mdl->size > 0)
+    {
+        data = (byte *)malloc (mdl->size);
+
+        if (!data || fread (data, 1, mdl->size, stream) < mdl->size)
+        {
+            free (data);
+            fclose (stream);
+            return false;
+        }
+    }
+
+    fclose (stream);
+
+    mdl->data = data;
+    mdl->mapped = false;
+    return true;
+}
+
+static bool mdl_map (mdlfile_t *mdl, const char *filename)
+{
+    void *data = NULL;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA (
+        filename,
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        NULL,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    FILETIME written;
+
+    if (!GetFileSizeEx (file, &size) || !GetFileTime (file, NULL, NULL, &written))
+    {
+        CloseHandle (file);
+        return false;
+    }
+
+    mdl->size = (size_t)size.QuadPart;
+    mdl->stamp.size = (uint64_t)size.QuadPart;
+    mdl->stamp.mtime = file_stamptime (&written);
+    mdl->stamped = true;
+
+    if (mdl->size > 0)
+    {
+        /* The view keeps the mapping alive once the handles are closed. */
+        HANDLE mapping = CreateFileMappingA (file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+        if (mapping)
+        {
+            data = MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle (mapping);
+        }
+    }
+
+    CloseHandle (file);
+#else
+    int fd = open (filename, O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+
+    if (fstat (fd, &st) < 0)
+    {
+        close (fd);
+        return false;
+    }
+
+    mdl->size = (size_t)st.st_size;
+    file_stampstat (&st, &mdl->stamp);
+    mdl->stamped = true;
+
+    if (mdl->size > 0)
+    {
+        data = mmap (NULL, mdl->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data == MAP_FAILED)
+            data = NULL;
+    }
+
+    close (fd);
+#endif
+
+    if (!data && mdl->size > 0)
+        return mdl_load (mdl, filename);
+
+    mdl->data = (const byte *)data;
+    mdl->mapped = true;
+    return true;
+}
+
+/* decomp_buffer's input, or a file its caller's read callback hands over. */
+static bool mdl_borrow (mdlfile_t *mdl, const char *filename)
+{
+    const void *data = curio->data;
+    size_t size = curio->size;
+
+    if (strcmp (filename, curio->name) != 0)
+    {
+        if (!curio->io->read || curio->io->read (curio->io->user, filename, &data, &size) != 0)
+            return false;
+    }
+
+    mdl->data = (const byte *)data;
+    mdl->size = size;
+    mdl->borrowed = true;
+    return true;
+}
+
+mdlfile_t *mdl_open (const char *filename, int *identifier, int *version, int safe)
+{
+    if (!safe)
+        msg_log (MSG_NORMAL, "Reading from \"%s\"...\n", filename);
+
+    mdlfile_t *stream = (mdlfile_t *)memalloc (1, sizeof (*stream));
+    statsphase_t phase = stats_begin (STATS_OPEN);
+
+    trace_begin ("read", filename);
+
+    if (curio && curio->io ? !mdl_borrow (stream, filename) : !mdl_map (stream, filename))
+    {
+        trace_end ();
+        stats_end (phase);
+        free (stream);
+        if (safe)
+            return NULL;
+        error (DECOMP_EREAD, "No input file\n");
+    }
+
+    trace_end ();
+    stats_end (phase);
+    STATS_COUNT (STATS_INPUTS, 1);
+    STATS_COUNT (STATS_INPUTBYTES, stream->size);
+
+    if (safe)
+        msg_log (MSG_NORMAL, "Reading from \"%s\"...\n", filename);
+
+    job_track (stream, true);
+    
+    if (identifier)
+    {
+        int32_t id;
+        mdl_readat (stream, 0, &id, sizeof (id));
+        *identifier = id;
+    }
+
+    if (version)
+    {
+        int32_t v;
+        mdl_readat (stream, sizeof (int32_t), &v, sizeof (v));
+        *version = v;
+    }
+    
+    return stream;
+}
+
+void mdl_close (mdlfile_t *stream)
+{
+    job_untrack (stream);
+
+    if (stream->mapped && stream->data)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile (stream->data);
+#else
+        munmap ((void *)stream->data, stream->size);
+#endif
+    }
+    else if (!stream->borrowed)
+    {
+        free ((void *)stream->data);
+    }
+
+    free (stream);
+}
+
+const void *mdl_ptr (mdlfile_t *stream, size_t off, size_t size)
+{
+    if (off > stream->size || size > stream->size - off)
+        error (DECOMP_EFORMAT, "Read failed\n");
+
+    if (stats_enabled)
+    {
+        stats_add (STATS_READS, 1);
+        stats_add (STATS_READBYTES, size);
+    }
+    
+    return stream->data + off;
+}
+
+void mdl_readat (mdlfile_t *stream, size_t off, void *dst, size_t size)
+{
+    memcpy (dst, mdl_ptr (stream, off, size), size);
+}
+
+char* mdl_getmotionflag (int type)
+{
+    switch (type & STUDIO_TYPES)
+    {
+    case STUDIO_X: return "X";
+    case STUDIO_Y: return "Y";
+    case STUDIO_Z: return "Z";
     case STUDIO_XR: return "XR";
     case STUDIO_YR: return "YR";
     case STUDIO_ZR: return "ZR";
@@ -294,18 +1250,43 @@ char* mdl_getmotionflag (int type)
     return "";
 }
 
-char *mdl_getactname (int type)
+/* Activity names by type, built on first use. Custom activities are beyond it. */
+#define ACT_MAXNAMES 256
+
+static const char *act_names[ACT_MAXNAMES];
+static volatile int32_t act_built = 0;
+static mutex_t act_lock = MUTEX_INIT;
+
+static void act_build (void)
 {
-    static char custom[64];
     int i;
 
-    for (i = 0; i < (int)(sizeof(activity_map) / sizeof(activity_map[0])); ++i)
+    mutex_lock (&act_lock);
+
+    if (!atomic_load32 (&act_built))
     {
-        if (activity_map[i].type == type)
-            return activity_map[i].name;
+        for (i = 0; activity_map[i].name; ++i)
+        {
+            if (activity_map[i].type >= 0 && activity_map[i].type < ACT_MAXNAMES)
+                act_names[activity_map[i].type] = activity_map[i].name;
+        }
+
+        atomic_cas32 (&act_built, 0, 1);
     }
 
-    snprintf (custom, sizeof(custom), "ACT_%i", type);
+    mutex_unlock (&act_lock);
+}
+
+/* Custom activities are printed into the caller's buffer. */
+const char *mdl_getactname (int type, char *custom, size_t size)
+{
+    if (!atomic_load32 (&act_built))
+        act_build ();
+
+    if (type >= 0 && type < ACT_MAXNAMES && act_names[type])
+        return act_names[type];
+
+    snprintf (custom, size, "ACT_%i", type);
     return custom;
 }
 
@@ -320,13 +1301,14 @@ void qc_makepath (const char *filename)
         path[name - filename] = '\0';
         if (!makepath (path))
         {
-            error (1, "Failed to make directory: \"%s\"\n", path);
+            error (DECOMP_EWRITE, "Failed to make directory: \"%s\"\n", path);
         }
         free (path);
     }
 }
 
-FILE *qc_open (const char *filepath, const char *filename, const char *ext, bool binary)
+/* The full path qc_open writes to, the caller frees it. */
+char *qc_makename (const char *filepath, const char *filename, const char *ext)
 {
     size_t len = strlen (filepath) + strlen (filename) + 8;
 
@@ -354,59 +1336,393 @@ FILE *qc_open (const char *filepath, const char *filename, const char *ext, bool
         strcat (fullname, ext);
     }
 
-    qc_makepath (fullname);
+    return fullname;
+}
 
-    fprintf (stdout, "Writing to \"%s\"...\n", fullname);
 
+struct qcfile_s
+{
+    FILE *stream;          /* On disk, or NULL. */
+    const decomp_io_t *io; /* Or the caller's. */
+    void *handle;
+    uint64_t *hash;        /* Chained over every write, or NULL. */
+};
+
+/* The next output this thread opens hashes everything written to it into hash, until it's closed. */
+void qc_hashnext (uint64_t *hash)
+{
+    *hash = 0;
+    nexthash = hash;
+}
+
+static void qc_hash (qcfile_t *stream, const void *ptr, size_t size)
+{
+    *stream->hash = hash64 (ptr, size, *stream->hash);
+}
+
+/* Whether filename has other names, Windows doesn't say without opening it. */
+static bool qc_islink (const char *filename)
+{
 #ifdef _WIN32
-    FILE *stream = fopen (fullname, binary ? "wb" : "w");
+    (void)filename;
+    return true;
 #else
-    FILE *stream = fopen (fullname, "w");
+    struct stat st;
+
+    return stat (filename, &st) == 0 && st.st_nlink > 1;
 #endif
+}
 
-    if (!stream)
-        error (1, "Failed to create file\n");
+static FILE *qc_fopen (const char *fullname, bool binary)
+{
+#ifdef _WIN32
+    return fopen (fullname, binary ? "wb" : "w");
+#else
+    (void)binary;
+    return fopen (fullname, "w");
+#endif
+}
+
+static qcfile_t *qc_create (const char *filepath, const char *filename, const char *ext, bool binary)
+{
+    char *fullname = qc_makename (filepath, filename, ext);
+    qcfile_t *stream = (qcfile_t *)memalloc (1, sizeof (*stream));
 
+    stream->hash = nexthash;
+    nexthash = NULL;
+
+    if (curio && curio->io)
+    {
+        msg_log (MSG_NORMAL, "Writing to \"%s\"...\n", fullname);
+
+        stream->io = curio->io;
+        stream->handle = stream->io->open (stream->io->user, fullname);
+
+        free (fullname);
+
+        if (!stream->handle)
+        {
+            free (stream);
+            error (DECOMP_EWRITE, "Failed to create file\n");
+        }
+
+        job_track (stream, false);
+
+        return stream;
+    }
+
+    qc_makepath (fullname);
+
+    msg_log (MSG_NORMAL, "Writing to \"%s\"...\n", fullname);
+
+    /* Only BMPs are ever -dedupe hard links, don't write through one. */
+    if (binary && qc_islink (fullname))
+        remove (fullname);
+
+    stream->stream = qc_fopen (fullname, binary);
+
+    /* A -serve client may have removed a directory made for an earlier request. */
+    if (!stream->stream && errno == ENOENT)
+    {
+        dir_clear ();
+        qc_makepath (fullname);
+        stream->stream = qc_fopen (fullname, binary);
+    }
+
+    if (!stream->stream)
+    {
+        free (fullname);
+        free (stream);
+        error (DECOMP_EWRITE, "Failed to create file\n");
+    }
+
+    io_output (fullname);
     free (fullname);
 
+    job_track (stream, false);
+
+    return stream;
+}
+
+qcfile_t *qc_open (const char *filepath, const char *filename, const char *ext, bool binary)
+{
+    statsphase_t phase = stats_begin (STATS_WRITE);
+    qcfile_t *stream = qc_create (filepath, filename, ext, binary);
+
+    stats_end (phase);
+    STATS_COUNT (STATS_OUTPUTS, 1);
+
     return stream;
 }
 
-void qc_putc (FILE *stream, char c)
+/* Closes what an aborted job left open. */
+static void qc_abort (qcfile_t *stream)
+{
+    if (stream->stream)
+        fclose (stream->stream);
+    else
+        stream->io->close (stream->io->user, stream->handle, 1);
+
+    free (stream);
+}
+
+void qc_close (qcfile_t *stream)
 {
-    if (fputc (c, stream) < 0)
-        error (1, "Write failed\n");
+    statsphase_t phase = stats_begin (STATS_WRITE);
+    int failed;
+
+    job_untrack (stream);
+
+    if (stream->stream)
+        failed = fclose (stream->stream) != 0;
+    else
+        failed = stream->io->close (stream->io->user, stream->handle, 0) != 0;
+
+    free (stream);
+    stats_end (phase);
+
+    if (failed)
+        error (DECOMP_EWRITE, "Write failed\n");
+}
+
+/* For callers that buffer everything themselves. */
+void qc_nobuffer (qcfile_t *stream)
+{
+    if (stream->stream)
+        setvbuf (stream->stream, NULL, _IONBF, 0);
+}
+
+void qc_writeb (qcfile_t *stream, const void *ptr, size_t size)
+{
+    statsphase_t phase = stats_begin (STATS_WRITE);
+
+    if (stream->hash)
+        qc_hash (stream, ptr, size);
+
+    if (stream->stream)
+    {
+        if (fwrite (ptr, 1, size, stream->stream) < size)
+            error (DECOMP_EWRITE, "Write failed\n");
+    }
+    else if (size > 0)
+    {
+        if (stream->io->write (stream->io->user, stream->handle, ptr, size) != 0)
+            error (DECOMP_EWRITE, "Write failed\n");
+    }
+
+    stats_end (phase);
+    STATS_COUNT (STATS_WRITEBYTES, size);
 }
 
-void qc_write (FILE *stream, const char *str)
+void qc_putc (qcfile_t *stream, char c)
 {
-    size_t len = strlen (str);
-    if (fwrite (str, 1, len, stream) < len)
-        error (1, "Write failed\n");
+    if (stream->stream)
+    {
+        if (fputc (c, stream->stream) < 0)
+            error (DECOMP_EWRITE, "Write failed\n");
+
+        if (stream->hash)
+            qc_hash (stream, &c, 1);
+
+        STATS_COUNT (STATS_WRITEBYTES, 1);
+    }
+    else
+    {
+        qc_writeb (stream, &c, 1);
+    }
+}
+
+void qc_write (qcfile_t *stream, const char *str)
+{
+    qc_writeb (stream, str, strlen (str));
     qc_putc (stream, '\n');
 }
 
-void qc_writef (FILE *stream, const char *fmt, ...)
+static void qc_vwritef (qcfile_t *stream, const char *fmt, va_list va)
+{
+    if (stream->stream && !stream->hash)
+    {
+        int written = vfprintf (stream->stream, fmt, va);
+
+        if (written < 0)
+            error (DECOMP_EWRITE, "Write failed\n");
+
+        STATS_COUNT (STATS_WRITEBYTES, written);
+        return;
+    }
+
+    /* A sink takes whole pieces & a hash needs the bytes, format into one first. */
+    char buf[1024];
+    char *text = buf;
+    va_list copy;
+
+    va_copy (copy, va);
+    int len = vsnprintf (buf, sizeof (buf), fmt, copy);
+    va_end (copy);
+
+    if (len < 0)
+        error (DECOMP_EWRITE, "Write failed\n");
+
+    if (len >= (int)sizeof (buf))
+    {
+        text = (char *)memalloc (len + 1, 1);
+        vsnprintf (text, len + 1, fmt, va);
+    }
+
+    qc_writeb (stream, text, len);
+
+    if (text != buf)
+        free (text);
+}
+
+void qc_writef (qcfile_t *stream, const char *fmt, ...)
 {
     va_list va;
     va_start (va, fmt);
-    if (vfprintf (stream, fmt, va) < 0)
-        error (1, "Write failed\n");
+    qc_vwritef (stream, fmt, va);
     va_end (va);
     qc_putc (stream, '\n');
 }
 
-void qc_write2f (FILE *stream, const char *fmt, ...)
+void qc_write2f (qcfile_t *stream, const char *fmt, ...)
 {
     va_list va;
     va_start (va, fmt);
-    if (vfprintf (stream, fmt, va) < 0)
-        error (1, "Write failed\n");
+    qc_vwritef (stream, fmt, va);
     va_end (va);
 }
 
-void qc_writeb (FILE *stream, void *ptr, size_t size)
+#ifndef _WIN32
+/* The most pieces one writev takes, at least the 16 POSIX promises. */
+static int qc_maxvecs (void)
+{
+    long n = sysconf (_SC_IOV_MAX);
+
+#ifdef IOV_MAX
+    if (n <= 0)
+        n = IOV_MAX;
+#endif
+
+    if (n < 16)
+        return 16;
+
+    return n < 0x10000 ? (int)n : 0x10000;
+}
+#endif
+
+/*
+    Writes the pieces back to back, straight from where they lie. Goes
+    around stdio, so nothing else may be written to the stream afterwards.
+*/
+void qc_writev (qcfile_t *stream, const qcvec_t *vecs, int count)
+{
+#ifdef _WIN32
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        qc_writeb (stream, vecs[i].base, vecs[i].size);
+    }
+#else
+    struct iovec *iov;
+    struct iovec *cur;
+    ssize_t written;
+    int i, n, left;
+
+    if (!stream->stream)
+    {
+        for (i = 0; i < count; ++i)
+        {
+            qc_writeb (stream, vecs[i].base, vecs[i].size);
+        }
+        return;
+    }
+
+    statsphase_t phase = stats_begin (STATS_WRITE);
+
+    if (fflush (stream->stream) != 0)
+        error (DECOMP_EWRITE, "Write failed\n");
+
+    int fd = fileno (stream->stream);
+    int max = qc_maxvecs ();
+    scratchmark_t mark = scratch_mark ();
+
+    /* A whole texture usually goes out in one call. */
+    iov = (struct iovec *)scratch_alloc (count > 0 && count < max ? count : max, sizeof (*iov));
+
+    for (; count > 0; vecs += n, count -= n)
+    {
+        n = count < max ? count : max;
+
+        for (i = 0; i < n; ++i)
+        {
+            iov[i].iov_base = (void *)vecs[i].base;
+            iov[i].iov_len = vecs[i].size;
+
+            if (stream->hash)
+                qc_hash (stream, vecs[i].base, vecs[i].size);
+        }
+
+        for (cur = iov, left = n; left > 0;)
+        {
+            written = writev (fd, cur, left);
+
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                error (DECOMP_EWRITE, "Write failed\n");
+            }
+
+            /* Skip what went out, a short write resumes mid-piece. */
+            while (left > 0 && (size_t)written >= cur->iov_len)
+            {
+                written -= cur->iov_len;
+                cur++;
+                left--;
+            }
+
+            if (left > 0)
+            {
+                cur->iov_base = (byte *)cur->iov_base + written;
+                cur->iov_len -= written;
+            }
+        }
+
+        if (stats_enabled)
+        {
+            for (i = 0; i < n; ++i)
+            {
+                stats_add (STATS_WRITEBYTES, vecs[i].size);
+            }
+        }
+    }
+
+    scratch_release (mark);
+    stats_end (phase);
+#endif
+}
+
+/* Sets aside the file's final size before it's written, where the system allows. */
+void qc_reserve (qcfile_t *stream, size_t size)
 {
-    if (fwrite (ptr, 1, size, stream) < size)
-        error (1, "Write failed\n");
+#if defined (__linux__)
+    if (!stream->stream)
+        return;
+
+    statsphase_t phase = stats_begin (STATS_WRITE);
+
+    /*
+        Not posix_fallocate, which on filesystems without fallocate (NFS say)
+        writes every block out instead, doubling what's written. Here that's
+        only EOPNOTSUPP, and the file grows as it's written.
+    */
+    fflush (stream->stream);
+    fallocate (fileno (stream->stream), 0, 0, size);
+
+    stats_end (phase);
+#else
+    (void)stream;
+    (void)size;
+#endif
 }
@@ -15,50 +15,48 @@ without written permission from Valve LLC.
 */
 
 #include "studio.h"
-
-void decomp_mdl (
-    const char *mdlname,
-    const char *qcname,
-    const char *cd,
-    const char *cdtexture,
-    const char *cdanim,
-    const char *qcdir,
-    const char *smddir);
-
-void decomp_spr (
-    const char *sprname,
-    const char *qcname,
-    const char *cd,
-    const char *qcdir,
-    const char *bmpdir);
-
-void decomp_wad (
-    const char *wadname,
-    const char *bmpdir,
-    const char *pattern);
-
-void decomp_bsptex (
-    const char *bspname,
-    const char *bmpdir,
-    const char *pattern);
+#include "thread.h"
 
 void info_mdl (
     const char *mdlname,
-    const char *args);
-
-static int getargs (
-    int argc,
-    char **argv,
-    char **cd,
-    bool *havecd,
-    char **cdtexture,
-    char **cdanim,
-    char **wadpattern)
+    const char *args,
+    bool useindex);
+
+typedef struct
+{
+    decomp_options_t decomp;
+    bool batch;
+    int numthreads;
+    char *serve;
+    bool serving; /* Parsing a -serve request. */
+    bool stats;
+    char *statsjson;
+    char *trace;
+} options_t;
+
+/* Options for the whole process, not one -serve request. */
+static bool isprocessoption (const char *arg)
+{
+    return !strcmp (arg, "-help")
+        || !strcmp (arg, "-info")
+        || !strcmp (arg, "-batch")
+        || !strcmp (arg, "-serve")
+        || !strcmp (arg, "-q")
+        || !strcmp (arg, "-v")
+        || !strcmp (arg, "-j")
+        || !strcmp (arg, "-stats")
+        || !strcmp (arg, "-trace");
+}
+
+static int getargs (int argc, char **argv, options_t *opts)
 {
     if (argc < 2)
     {
 print_help:
-        fprintf (stdout, "Usage: decompmdl [options...] <input {*.mdl | *.spr | *.wad | *.bsp}> [<output {directory | *.qc}>]\n\n");
+        fprintf (stdout, "Usage: decompmdl [options...] <input {*.mdl | *.spr | *.wad | *.bsp}> [<output {directory | *.qc}>]\n");
+        fprintf (stdout, "       decompmdl [options...] <input>... [<output directory>]\n");
+        fprintf (stdout, "       decompmdl [options...] -batch <{directory | wildcard | list file}...>\n");
+        fprintf (stdout, "       decompmdl [options...] -serve <socket>\n\n");
         fprintf (stdout, "Options:\n");
         fprintf (stdout, "\t-help\t\t\tDisplay this message and exit.\n\n");
 
@@ -76,8 +74,62 @@ print_help:
 \t\t\t\tDefaults to \"./anims\".\n\n");
         
         fprintf (stdout,
-"\t-pattern <string>\tIf set, only textures containing the matching\n\
-\t\t\t\tsubstring will be extracted from WADs and BSPs.\n\n");
+"\t-pattern <string>\tIf set, only matching textures will be extracted\n\
+\t\t\t\tfrom WADs and BSPs. A comma separated list of\n\
+\t\t\t\tsubstrings and whole name wildcards, e.g.\n\
+\t\t\t\t\"sky,*_lit,{*\" for any of them.\n\n");
+        
+        fprintf (stdout,
+"\t-batch\t\t\tEvery remaining argument is a directory (searched\n\
+\t\t\t\trecursively), a wildcard pattern, an input file, or a\n\
+\t\t\t\tlist file with one of those per line. T.mdl and NN.mdl\n\
+\t\t\t\tcompanions are skipped. Each input is placed in its own\n\
+\t\t\t\tsub directory, mirroring the searched directories.\n\n");
+        
+        fprintf (stdout,
+"\t-serve <socket>\t\tStay resident and take requests on a Unix socket,\n\
+\t\t\t\teach the arguments of a command line, one per line,\n\
+\t\t\t\tended by an empty line. Replies list the files written,\n\
+\t\t\t\tthe output, and the status. Not supported on Windows.\n\n");
+        
+        fprintf (stdout,
+"\t-index\t\t\tKeep a \"<file>.idx\" texture index next to WADs and\n\
+\t\t\t\tBSPs, rebuilt when the file changes. Speeds up repeat\n\
+\t\t\t\t-pattern and -info queries. Must precede -info.\n\n");
+        
+        fprintf (stdout,
+"\t-dedupe <mode>\t\tTextures identical to one already extracted from a\n\
+\t\t\t\tWAD or BSP this run are \"skip\"ped, hard \"link\"ed to\n\
+\t\t\t\tthe first copy, or left out and listed in a\n\
+\t\t\t\t\"<file>_duplicates.txt\" \"manifest\".\n\n");
+        
+        fprintf (stdout,
+"\t-incremental\t\tKeep a \"<qc>.manifest\" of the model's outputs next\n\
+\t\t\t\tto the QC, and leave SMDs & BMPs whose inputs haven't\n\
+\t\t\t\tchanged since the last run alone.\n\n");
+        
+        fprintf (stdout,
+"\t-q\t\t\tQuiet, only print results, warnings and errors.\n\n");
+        
+        fprintf (stdout,
+"\t-v\t\t\tVerbose, print extra detail.\n\n");
+        
+        fprintf (stdout,
+"\t-j <count>\t\tNumber of worker threads, shared by input files,\n\
+\t\t\t\tsequences and WAD/BSP textures. Defaults to the\n\
+\t\t\t\tnumber of CPU cores.\n\n");
+        
+        fprintf (stdout,
+"\t-stats [<file.json>]\tWhen done, print the time spent in each phase\n\
+\t\t\t\t(reading, headers, bodygroups, sequences, textures,\n\
+\t\t\t\tsprite frames, WAD lumps, writing) and what was read\n\
+\t\t\t\tand written. Also written to the JSON file if given.\n\n");
+        
+        fprintf (stdout,
+"\t-trace <file.json>\tRecord when each file, sequence, blend, model and\n\
+\t\t\t\ttexture was read, decoded and written, and on which\n\
+\t\t\t\tthread, for chrome://tracing or ui.perfetto.dev.\n\
+\t\t\t\tNot with -serve.\n\n");
         
         fprintf (stdout,
 "\t-info [<string>]\tFile info will be printed. No decompiling will occur.\n\
@@ -97,7 +149,11 @@ print_help:
         if (argv[i][0] != '-')
             break;
         
-        if (!strcmp (argv[i], "-help"))
+        if (opts->serving && isprocessoption (argv[i]))
+        {
+            error (DECOMP_EINVAL, "\"%s\" can't be used in a -serve request\n", argv[i]);
+        }
+        else if (!strcmp (argv[i], "-help"))
         {
             goto print_help;
         }
@@ -105,167 +161,334 @@ print_help:
         {
             if (i < argc - 1)
             {
-                info_mdl (argv[argc - 1], (i + 1 < argc - 1) ? argv[i + 1] : NULL);
+                info_mdl (argv[argc - 1], (i + 1 < argc - 1) ? argv[i + 1] : NULL, opts->decomp.index);
                 exit (0);
             }
             goto print_help;
         }
         else if (!strcmp (argv[i], "-cd"))
         {
-            *cd = argv[i + 1];
-            *havecd = true;
-            fprintf (stdout, "Data path set to: \"%s\"\n", *cd);
+            if (i + 1 >= argc)
+                error (DECOMP_EINVAL, "No data path provided\n");
+
+            opts->decomp.cd = argv[i + 1];
+            msg_printf ("Data path set to: \"%s\"\n", opts->decomp.cd);
             ++i;
         }
         else if (!strcmp (argv[i], "-cdtexture"))
         {
-            *cdtexture = argv[i + 1];
-            fprintf (stdout, "Texture path set to: \"%s\"\n", *cdtexture);
+            if (i + 1 >= argc)
+                error (DECOMP_EINVAL, "No texture path provided\n");
+
+            opts->decomp.cdtexture = argv[i + 1];
+            msg_printf ("Texture path set to: \"%s\"\n", opts->decomp.cdtexture);
             ++i;
         }
         else if (!strcmp (argv[i], "-cdanim"))
         {
-            *cdanim = argv[i + 1];
-            fprintf (stdout, "Animation path set to: \"%s\"\n", *cdanim);
+            if (i + 1 >= argc)
+                error (DECOMP_EINVAL, "No animation path provided\n");
+
+            opts->decomp.cdanim = argv[i + 1];
+            msg_printf ("Animation path set to: \"%s\"\n", opts->decomp.cdanim);
             ++i;
         }
         else if (!strcmp (argv[i], "-pattern"))
         {
-            *wadpattern = argv[i + 1];
-            fprintf (stdout, "WAD search pattern set to: \"%s\"\n", *wadpattern);
+            if (i + 1 >= argc)
+                error (DECOMP_EINVAL, "No search pattern provided\n");
+
+            fixpath (argv[i + 1], true);
+            opts->decomp.pattern = argv[i + 1];
+            msg_printf ("WAD search pattern set to: \"%s\"\n", opts->decomp.pattern);
+            ++i;
+        }
+        else if (!strcmp (argv[i], "-batch"))
+        {
+            opts->batch = true;
+        }
+        else if (!strcmp (argv[i], "-serve"))
+        {
+            if (i + 1 >= argc)
+                error (DECOMP_EINVAL, "No socket path provided\n");
+
+            opts->serve = argv[i + 1];
+            ++i;
+        }
+        else if (!strcmp (argv[i], "-index"))
+        {
+            opts->decomp.index = true;
+        }
+        else if (!strcmp (argv[i], "-dedupe"))
+        {
+            const char *mode = (i + 1 < argc) ? argv[i + 1] : "";
+
+            if (!strcmp (mode, "skip"))
+                opts->decomp.dedupe = DECOMP_DEDUPE_SKIP;
+            else if (!strcmp (mode, "link"))
+                opts->decomp.dedupe = DECOMP_DEDUPE_LINK;
+            else if (!strcmp (mode, "manifest"))
+                opts->decomp.dedupe = DECOMP_DEDUPE_MANIFEST;
+            else
+                error (DECOMP_EINVAL, "Unknown dedupe mode: \"%s\"\n", mode);
+            
+            ++i;
+        }
+        else if (!strcmp (argv[i], "-incremental"))
+        {
+            opts->decomp.incremental = true;
+        }
+        else if (!strcmp (argv[i], "-q"))
+        {
+            decomp_setlevel (DECOMP_MSG_RESULT);
+        }
+        else if (!strcmp (argv[i], "-v"))
+        {
+            decomp_setlevel (DECOMP_MSG_DETAIL);
+        }
+        else if (!strcmp (argv[i], "-j"))
+        {
+            opts->numthreads = (i + 1 < argc) ? atoi (argv[i + 1]) : 0;
+            ++i;
+        }
+        else if (!strcmp (argv[i], "-stats"))
+        {
+            char *name, *ext;
+
+            opts->stats = true;
+
+            if (i + 1 < argc)
+            {
+                filebase (argv[i + 1], &name, &ext);
+
+                if (!strcasecmp (ext, ".json"))
+                    opts->statsjson = argv[++i];
+            }
+        }
+        else if (!strcmp (argv[i], "-trace"))
+        {
+            if (i + 1 >= argc)
+                error (DECOMP_EINVAL, "No trace file provided\n");
+
+            opts->trace = argv[i + 1];
             ++i;
         }
         else
         {
-            fprintf (stdout, "Unknown option: \"%s\"\n", argv[i]);
+            msg_printf ("Unknown option: \"%s\"\n", argv[i]);
         }
     }
 
-    if (i >= argc)
+    if (i >= argc && !opts->serve)
     {
-        error (1, "No input file provided\n");
+        error (DECOMP_EINVAL, "No input file provided\n");
+    }
+
+    /* A server never ends, the trace would only grow. */
+    if (opts->serve && opts->trace)
+    {
+        error (DECOMP_EINVAL, "-trace can't be used with -serve\n");
     }
 
     return i;
 }
 
-static void getdirs (
-    char *in,
-    char *out,
-    char **qcdir,
-    char **qcname,
-    bool havecd)
+typedef struct
 {
-    if (havecd)
+    batchfile_t *file;
+    const options_t *opts;
+    bool done;
+} batchjob_t;
+
+static void decomp_batchfile (void *arg)
+{
+    batchjob_t *job = (batchjob_t *)arg;
+
+    msg_log (MSG_NORMAL, "\n=== %s ===\n\n", job->file->path);
+
+    job->done = decomp_path (job->file->path, job->file->outdir, &job->opts->decomp, NULL) == DECOMP_OK;
+}
+
+/* Every file is its own task, a failed one doesn't stop the rest. */
+static int decomp_files (batchfile_t *files, int numfiles, const options_t *opts)
+{
+    batchjob_t *jobs = (batchjob_t *)memalloc (numfiles, sizeof (*jobs));
+    taskgroup_t group = {0, 0};
+    int i, numsuccess = 0;
+
+    for (i = 0; i < numfiles; ++i)
     {
-        *qcdir = ".";
+        jobs[i].file = &files[i];
+        jobs[i].opts = opts;
+        pool_submit (&group, decomp_batchfile, &jobs[i]);
     }
 
-    if (!out) /* Put files in sub directory. */
+    pool_wait (&group);
+
+    msg_printf ("\n================\n\n");
+
+    for (i = 0; i < numfiles; ++i)
     {
-        *qcname = strdup (skippath (in));
-        stripext (*qcname);
+        msg_printf ("%-8s%s\n", jobs[i].done ? "OK" : "FAILED", files[i].path);
 
-        if (!havecd)
-        {
-            *qcdir = strdup (*qcname);
-        }
-        return;
+        if (jobs[i].done)
+            numsuccess++;
     }
 
+    msg_printf ("\nDecompiled %i / %i file(s).\n", numsuccess, numfiles);
+
+    int peakkib, reservedkib;
+    scratch_stats (&peakkib, &reservedkib);
+    msg_log (MSG_VERBOSE, "Scratch memory: %i KiB peak per thread, %i KiB held.\n", peakkib, reservedkib);
+
+    free (jobs);
+
+    return numsuccess == numfiles ? 0 : 1;
+}
+
+static int decomp_batch (char **sources, int numsources, const options_t *opts)
+{
+    int numfiles;
+    batchfile_t *files = batch_collect (sources, numsources, &numfiles);
+
+    if (numfiles == 0)
+    {
+        error (1, "No input files found\n");
+    }
+
+    int code = decomp_files (files, numfiles, opts);
+
+    batch_free (files, numfiles);
+
+    return code;
+}
+
+/* Several inputs on the command line, optionally followed by an output directory. */
+static int decomp_inputs (char **inputs, int numinputs, char *out, const options_t *opts)
+{
     char *name, *ext;
-    
-    filebase (out, &name, &ext);
-    
-    if (*ext) /* QC name provided. Put files in root directory. */
+    int i;
+
+    if (out)
     {
-        *qcname = strdup (out);
-        stripext (*qcname);
+        filebase (out, &name, &ext);
 
-        if (!havecd)
-        {
-            *qcdir = strdup (out);
-            stripfilename (*qcdir);
-        }
+        if (*ext)
+            error (1, "Output must be a directory when decompiling several files\n");
     }
-    else /* Put files in sub directory. */
+
+    batchfile_t *files = (batchfile_t *)memalloc (numinputs, sizeof (*files));
+
+    for (i = 0; i < numinputs; ++i)
     {
-        *qcname = strdup (skippath (in));
-        stripext (*qcname);
+        files[i].path = strdup (inputs[i]);
+        files[i].outdir = out ? strdup (out) : NULL;
+    }
 
-        if (!havecd)
-        {
-            *qcdir = appenddir (out, *qcname);
-        }
+    int code = decomp_files (files, numinputs, opts);
+
+    batch_free (files, numinputs);
+
+    return code;
+}
+
+typedef struct
+{
+    int argc;
+    char **argv;
+    const decomp_report_t *report;
+    int code; /* The first input's to fail. */
+} request_t;
+
+static void decomp_request (void *arg)
+{
+    request_t *req = (request_t *)arg;
+    options_t opts = {{NULL, NULL, NULL, NULL, 0, DECOMP_DEDUPE_NONE, 0}, false, 0, NULL, true, false, NULL, NULL};
+    int i = getargs (req->argc, req->argv, &opts);
+    int numinputs = req->argc - i;
+    char *out = NULL;
+    int code;
+
+    if (numinputs > 1 && !batch_isinput (req->argv[req->argc - 1]))
+    {
+        out = req->argv[req->argc - 1];
+        numinputs--;
     }
+
+    for (; numinputs > 0; ++i, --numinputs)
+    {
+        code = decomp_path (req->argv[i], out, &opts.decomp, req->report);
+
+        if (code != DECOMP_OK && req->code == DECOMP_OK)
+            req->code = code;
+    }
+}
+
+/* Each -serve request is a run of its own, as far as -dedupe goes. */
+static int decomp_serverequest (int argc, char **argv, const decomp_report_t *report)
+{
+    static volatile int32_t numruns = 0;
+    request_t req = {argc, argv, report, DECOMP_OK};
+    iocontext_t ctx = {NULL, report, NULL, NULL, 0, (uint32_t)atomic_add32 (&numruns, 1)};
+
+    /* So what getargs prints goes to the client too. */
+    iocontext_t *prev = io_set (&ctx);
+    int code = job_run (decomp_request, &req);
+    io_set (prev);
+
+    dedupe_forget (ctx.run);
+
+    return code != 0 ? code : req.code;
 }
 
 int main (int argc, char **argv)
 {
-    char *cd = ".";
-    bool havecd = false;
-    char *cdtexture = NULL;
-    char *cdanim = NULL;
-    char *wadpattern = NULL;
+    options_t opts = {{NULL, NULL, NULL, NULL, 0, DECOMP_DEDUPE_NONE, 0}, false, 0, NULL, false, false, NULL, NULL};
+    int code = 0;
 
-    int i = getargs (argc, argv, &cd, &havecd, &cdtexture, &cdanim, &wadpattern);
-    
-    char *in = argv[i];
-    char *out = (i + 1 < argc) ? argv[i + 1] : NULL;
+    int i = getargs (argc, argv, &opts);
 
-    char *qcdir, *qcname;
+    msg_start ();
 
-    getdirs (in, out, &qcdir, &qcname, havecd);
+    if (opts.stats)
+        stats_start ();
 
-    char *smddir = appenddir (qcdir, cd);
+    if (opts.trace)
+        trace_start (opts.trace);
 
-    char *name, *ext;
-    filebase (in, &name, &ext);
-    if (!strcasecmp (ext, ".spr"))
-    {
-        if (cdtexture == NULL)
-            cdtexture = "./bmp";
+    decomp_init (opts.numthreads > 0 ? opts.numthreads : 0);
+    msg_log (MSG_VERBOSE, "Using %i worker thread(s)\n", pool_numthreads ());
 
-        char *bmpdir = appenddir (qcdir, cdtexture);
-        decomp_spr (in, skippath (qcname), cdtexture, qcdir, bmpdir);
-        free (bmpdir);
-    }
-    else if (!strcasecmp (ext, ".wad"))
-    {
-        if (cdtexture == NULL)
-            cdtexture = "./bmp";
+    int numinputs = argc - i;
+    char *out = NULL;
 
-        char *bmpdir = appenddir (qcdir, cdtexture);
-        decomp_wad (in, bmpdir, wadpattern);
-        free (bmpdir);
+    if (opts.serve)
+    {
+        code = serve_run (opts.serve, decomp_serverequest);
     }
-    else if (!strcasecmp (ext, ".bsp"))
+    else if (opts.batch)
     {
-        if (cdtexture == NULL)
-            cdtexture = "./bmp";
-
-        char *bmpdir = appenddir (qcdir, cdtexture);
-        decomp_bsptex (in, bmpdir, wadpattern);
-        free (bmpdir);
+        code = decomp_batch (argv + i, numinputs, &opts);
     }
     else
     {
-        if (cdtexture == NULL)
-            cdtexture = "./maps_8bit";
-        
-        if (cdanim == NULL)
-            cdanim = "./anims";
-        
-        decomp_mdl (in, skippath (qcname), cd, cdtexture, cdanim, qcdir, smddir);
-    }
+        /* The last argument is the output, unless it's another input. */
+        if (numinputs > 1 && !batch_isinput (argv[argc - 1]))
+        {
+            out = argv[argc - 1];
+            numinputs--;
+        }
 
-    free (smddir);
-    free (qcname);
-    
-    if (!havecd)
-    {
-        free (qcdir);
+        if (numinputs == 1)
+            code = decomp_path (argv[i], out, &opts.decomp, NULL);
+        else
+            code = decomp_inputs (argv + i, numinputs, out, &opts);
     }
 
-    return 0;
-}
\ No newline at end of file
+    decomp_shutdown ();
+    stats_report (opts.statsjson);
+    trace_stop ();
+    msg_stop ();
+
+    return code;
+}
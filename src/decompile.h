@@ -17,6 +17,8 @@ without written permission from Valve LLC.
 #ifndef _DECOMPILE_H
 #define _DECOMPILE_H
 
+#include "libdecomp.h"
+
 #define STUDIO_VERSION 10
 
 #define IDSTUDIOHEADER (('T' << 24) + ('S' << 16) + ('D' << 8) + 'I')
@@ -61,6 +63,29 @@ typedef struct
 #define bone_print(v) v[0], v[1], v[2], v[3], v[4], v[5]
 
 void error (int code, const char *fmt, ...);
+int job_run (void (*func) (void *), void *arg);
+
+/* Console output a thread holds back, so it can be printed in a fixed order. */
+typedef struct
+{
+	char *data;
+	size_t len;
+	size_t max;
+} msgbuf_t;
+
+/* -q shows results & problems only, -v adds detail. */
+#define MSG_QUIET DECOMP_MSG_RESULT
+#define MSG_NORMAL DECOMP_MSG_INFO
+#define MSG_VERBOSE DECOMP_MSG_DETAIL
+
+void msg_setlevel (int level);
+void msg_start (void);
+void msg_stop (void);
+void msg_printf (const char *fmt, ...);
+void msg_log (int level, const char *fmt, ...);
+void msg_warning (const char *fmt, ...);
+msgbuf_t *msg_capture (msgbuf_t *buf);
+void msg_flush (msgbuf_t *buf);
 
 void fixpath (char *str, bool lower);
 char *skippath (char *str);
@@ -70,8 +95,90 @@ char *appenddir (char *path, char *dir);
 void filebase (char *str, char **name, char **ext);
 bool makepath (const char *path);
 
+/* What tells a file was changed, without reading it. */
+typedef struct
+{
+	uint64_t size;
+	int64_t mtime; /* Nanoseconds, as finely as the system keeps it. */
+} filestamp_t;
+
+bool file_stamp (const char *path, filestamp_t *stamp);
+
 void *memalloc (size_t nmemb, size_t size);
 
+/* Position in this thread's scratch arena, see scratch_alloc. */
+typedef struct
+{
+	void *block;
+	size_t used;
+} scratchmark_t;
+
+void *scratch_alloc (size_t nmemb, size_t size);
+scratchmark_t scratch_mark (void);
+void scratch_release (scratchmark_t mark);
+void scratch_shutdown (void);
+void scratch_stats (int *peakkib, int *reservedkib);
+char *scratch_appenddir (const char *path, const char *dir);
+uint64_t hash64 (const void *data, size_t size, uint64_t seed);
+
+/* What -stats times, a thread is in one phase at a time, see stats.c. */
+typedef enum
+{
+	STATS_OTHER,      /* None of the below, e.g. -batch searches. */
+	STATS_OPEN,       /* Finding & mapping inputs. */
+	STATS_HEADER,     /* Headers & QC commands. */
+	STATS_BODYGROUPS, /* Reference SMDs. */
+	STATS_SEQUENCES,  /* Animation SMDs. */
+	STATS_TEXTURES,   /* Model texture BMPs. */
+	STATS_SPRFRAMES,  /* Sprite frame BMPs. */
+	STATS_WADLUMPS,   /* WAD & BSP texture BMPs. */
+	STATS_WRITE,      /* Creating, writing & closing outputs. */
+	STATS_WAIT,       /* Blocked on tasks running on other threads. */
+	STATS_IDLE,       /* Workers with nothing to do, not reported. */
+	STATS_NUMPHASES
+} statsphase_t;
+
+typedef enum
+{
+	STATS_INPUTS,     /* Files opened. */
+	STATS_INPUTBYTES, /* Their size. */
+	STATS_READS,      /* Fetches from inputs, they're mapped so there are no seeks. */
+	STATS_READBYTES,
+	STATS_OUTPUTS,    /* Files created. */
+	STATS_WRITEBYTES,
+	STATS_TRIANGLES,  /* Written to reference SMDs. */
+	STATS_VERTICES,   /* Of the models exported. */
+	STATS_FRAMES,     /* Written to animation SMDs. */
+	STATS_BITMAPS,    /* BMPs written. */
+	STATS_NUMCOUNTERS
+} statscounter_t;
+
+extern bool stats_enabled;
+
+/* Cheap enough for the hot paths while -stats is off. */
+#define STATS_COUNT(counter, value) (stats_enabled ? stats_add ((counter), (value)) : (void)0)
+
+void stats_clock (int64_t *wall, int64_t *cpu);
+void stats_start (void);
+statsphase_t stats_begin (statsphase_t phase);
+void stats_end (statsphase_t prev);
+statsphase_t stats_phase (void);
+void stats_add (statscounter_t counter, int64_t value);
+void stats_threaddone (void);
+void stats_counters (int64_t *counters);
+void stats_stop (void);
+void stats_report (const char *json);
+
+/* -trace, nested spans per thread written as Chrome trace events, see trace.c. */
+extern bool trace_enabled;
+
+void trace_start (const char *path);
+void trace_begin (const char *cat, const char *name);
+void trace_end (void);
+int trace_depth (void);
+void trace_unwind (int depth);
+void trace_stop (void);
+
 #define	Q_PI 3.14159265358979323846F
 
 #define dot(x, y) ((x)[0] * (y)[0] + (x)[1] * (y)[1] + (x)[2] * (y)[2])
@@ -81,19 +188,180 @@ void quaternionmatrix (const vec4_t quaternion, mat4x3_t matrix);
 void concattransforms (const mat4x3_t in1, const mat4x3_t in2, mat4x3_t out);
 void vectortransform (const vec3_t in1, const mat4x3_t in2, vec3_t out);
 void vectorrotate (const vec3_t in1, const mat4x3_t in2, vec3_t out);
+void vectortransformbatch (const vec3_t *in, int count, const mat4x3_t mat, vec3_t *out);
+void vectorrotatebatch (const vec3_t *in, int count, const mat4x3_t mat, vec3_t *out);
+
+/*
+    Input files are mapped read-only, structures are fetched straight from the mapping.
+    Every read names its offset, there's no shared cursor, so threads may read at once.
+*/
+typedef struct
+{
+	const byte *data;
+	size_t size;
+	bool mapped;
+	bool borrowed;     /* The caller's buffer, see iocontext_t. */
+	bool stamped;      /* Read from disk, stamp is the file that was opened. */
+	filestamp_t stamp;
+} mdlfile_t;
 
-FILE *mdl_open (const char *filename, int *identifier, int *version, int safe);
-void mdl_read (FILE *stream, void *dst, size_t size);
-void mdl_seek (FILE *stream, long off, int whence);
+/*
+    Set by decomp_buffer, inputs & outputs go through the caller's io instead
+    of the disk. Set by decomp_path with a report, they stay on disk.
+*/
+typedef struct
+{
+	const decomp_io_t *io;
+	const decomp_report_t *report;
+	const char *name; /* The input, read from data & size. */
+	const void *data;
+	size_t size;
+	uint32_t run;     /* What -dedupe counts as one run, each -serve request has its own. */
+} iocontext_t;
+
+iocontext_t *io_set (iocontext_t *ctx);
+iocontext_t *io_get (void);
+void io_output (const char *path);
+
+mdlfile_t *mdl_open (const char *filename, int *identifier, int *version, int safe);
+void mdl_close (mdlfile_t *stream);
+const void *mdl_ptr (mdlfile_t *stream, size_t off, size_t size);
+void mdl_readat (mdlfile_t *stream, size_t off, void *dst, size_t size);
 char* mdl_getmotionflag (int type);
-char *mdl_getactname (int type);
+const char *mdl_getactname (int type, char *custom, size_t size);
 
 void qc_makepath (const char *filename);
-FILE *qc_open (const char *filepath, const char *filename, const char *ext, bool binary);
-void qc_putc (FILE *stream, char c);
-void qc_write (FILE *stream, const char *str);
-void qc_writef (FILE *stream, const char *fmt, ...);
-void qc_write2f (FILE *stream, const char *fmt, ...);
-void qc_writeb (FILE *stream, void *ptr, size_t size);
+char *qc_makename (const char *filepath, const char *filename, const char *ext);
+
+/* An output, on disk or in the caller's io. */
+typedef struct qcfile_s qcfile_t;
+
+qcfile_t *qc_open (const char *filepath, const char *filename, const char *ext, bool binary);
+void qc_close (qcfile_t *stream);
+void qc_nobuffer (qcfile_t *stream);
+void qc_putc (qcfile_t *stream, char c);
+void qc_write (qcfile_t *stream, const char *str);
+void qc_writef (qcfile_t *stream, const char *fmt, ...);
+void qc_write2f (qcfile_t *stream, const char *fmt, ...);
+void qc_writeb (qcfile_t *stream, const void *ptr, size_t size);
+void qc_hashnext (uint64_t *hash);
+
+/* One piece of a qc_writev. */
+typedef struct
+{
+	const void *base;
+	size_t size;
+} qcvec_t;
+
+void qc_writev (qcfile_t *stream, const qcvec_t *vecs, int count);
+void qc_reserve (qcfile_t *stream, size_t size);
+
+/* SMD output is formatted by hand into a large buffer, it's the bulk of what gets written. */
+#define SMD_BUFSIZE 0x10000
+
+typedef struct
+{
+	qcfile_t *stream;
+	size_t len;
+	char buf[SMD_BUFSIZE];
+} smdfile_t;
+
+smdfile_t *smd_open (const char *filepath, const char *filename);
+void smd_close (smdfile_t *smd);
+void smd_puts (smdfile_t *smd, const char *str);
+void smd_write (smdfile_t *smd, const char *str);
+void smd_writetime (smdfile_t *smd, int time);
+void smd_writebone (smdfile_t *smd, int bone, const vec3_t pos, const vec3_t rot);
+void smd_writevert (smdfile_t *smd, int bone, const vec3_t vert, const vec3_t norm, float s, float t);
+
+/* A model texture, preprocessed once for every writer that names it. */
+typedef struct
+{
+	char name[65];    /* Lowercase, without extension. */
+	const char *base; /* The name without its path. */
+	float invwidth;
+	float invheight;
+} modeltexture_t;
+
+/* Every texture of a model, reached through the skin families. */
+typedef struct
+{
+	int numtextures;
+	int numskinref;
+	int numskinfamilies;
+	const short *skins;
+	modeltexture_t *textures;
+} texturetable_t;
+
+const modeltexture_t *decomp_skintexture (const texturetable_t *table, int family, int skinref);
+
+/* A miptex of a WAD or BSP as kept in its sidecar index. */
+typedef struct
+{
+	char name[20];   /* Lowercase, null terminated. */
+	uint32_t offset; /* The miptex_t. */
+	uint32_t pixels; /* The first mip level. */
+	uint32_t width;
+	uint32_t height;
+	uint32_t size;   /* Header, mip levels and palette. */
+	uint32_t order;  /* Place in the WAD's lump directory or the BSP's miptex list. */
+	uint64_t hash;   /* First mip level and palette. */
+} texindexentry_t;
+
+typedef struct
+{
+	int count;
+	texindexentry_t *entries;
+} texindex_t;
+
+texindex_t *index_open (const char *filename, mdlfile_t *file, bool wad);
+void index_free (texindex_t *index);
+
+/* -incremental output manifest, see manifest.c. NULL turns it off. */
+typedef struct manifest_s manifest_t;
+
+manifest_t *manifest_open (const char *filepath, const char *filename);
+uint64_t manifest_hashinput (mdlfile_t *file);
+bool manifest_skip (manifest_t *manifest, const char *filepath, const char *filename, const char *ext, uint64_t inputs, uint64_t *hash);
+void manifest_record (manifest_t *manifest, const char *filepath, const char *filename, const char *ext, uint64_t inputs, uint64_t hash);
+void manifest_close (manifest_t *manifest);
+
+/* Compiled -pattern, see pattern.c. */
+typedef struct pattern_s pattern_t;
+
+pattern_t *pattern_compile (const char *str);
+bool pattern_match (const pattern_t *pattern, const char *name);
+void pattern_free (pattern_t *pattern);
+
+/* What -dedupe does with a texture already extracted this run. */
+typedef enum
+{
+	DEDUPE_NONE = DECOMP_DEDUPE_NONE,
+	DEDUPE_SKIP = DECOMP_DEDUPE_SKIP,         /* Leave it out. */
+	DEDUPE_LINK = DECOMP_DEDUPE_LINK,         /* Hard link it to the first copy. */
+	DEDUPE_MANIFEST = DECOMP_DEDUPE_MANIFEST, /* Leave it out, and list it in "<input>_duplicates.txt". */
+} dedupe_t;
+
+int32_t dedupe_begin (void);
+const char *dedupe_claim (int32_t owner, uint64_t hash, int width, int height, const char *path);
+void dedupe_written (int32_t owner, uint64_t hash, int width, int height);
+bool dedupe_link (const char *original, const char *path);
+void dedupe_forget (uint32_t run);
+
+/* Inputs found by -batch, with the sub directory to mirror in the output. */
+typedef struct
+{
+	char *path;
+	char *outdir;
+} batchfile_t;
+
+bool batch_isinput (const char *path);
+batchfile_t *batch_collect (char **sources, int numsources, int *numfiles);
+void batch_free (batchfile_t *files, int numfiles);
+
+/* Runs one -serve request's arguments as a command line, returns its DECOMP_* code. */
+typedef int (*servehandler_t) (int argc, char **argv, const decomp_report_t *report);
+
+int serve_run (const char *path, servehandler_t handler);
 
 #endif /* _DECOMPILE_H */
@@ -0,0 +1,182 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "studio.h"
+#include "thread.h"
+
+/*
+    Textures extracted so far this run, by content. Shared by every job, so a
+    duplicate in any WAD or BSP points back at the first copy written. Runs
+    are told apart by iocontext_t's, a -serve request doesn't see another's.
+    Each file claims as its own owner, and another file only gets a copy once
+    it's written.
+*/
+typedef struct
+{
+    uint64_t hash;
+    uint32_t width;
+    uint32_t height;
+    uint32_t run;
+    int32_t owner;
+    bool written;
+    char *path; /* NULL if the slot is free. */
+} dedupeentry_t;
+
+static mutex_t dedupe_lock = MUTEX_INIT;
+static dedupeentry_t *dedupe_entries = NULL;
+static size_t dedupe_count = 0;
+static size_t dedupe_max = 0; /* Always a power of 2. */
+static volatile int32_t dedupe_owners = 0;
+
+static dedupeentry_t *dedupe_find (dedupeentry_t *entries, size_t max, uint64_t hash, uint32_t width, uint32_t height, uint32_t run)
+{
+    size_t i = (size_t)(hash ^ run) & (max - 1);
+
+    while (entries[i].path)
+    {
+        if (entries[i].hash == hash && entries[i].width == width && entries[i].height == height && entries[i].run == run)
+            break;
+        
+        i = (i + 1) & (max - 1);
+    }
+
+    return &entries[i];
+}
+
+/* Rehashes into max slots, leaving out forget's entries. */
+static void dedupe_rehash (size_t max, const uint32_t *forget)
+{
+    dedupeentry_t *entries = (dedupeentry_t *)memalloc (max, sizeof (*entries));
+    dedupeentry_t *entry;
+    size_t i;
+
+    dedupe_count = 0;
+
+    for (i = 0; i < dedupe_max; ++i)
+    {
+        entry = &dedupe_entries[i];
+
+        if (!entry->path)
+            continue;
+
+        if (forget && entry->run == *forget)
+        {
+            free (entry->path);
+            continue;
+        }
+
+        *dedupe_find (entries, max, entry->hash, entry->width, entry->height, entry->run) = *entry;
+        dedupe_count++;
+    }
+
+    free (dedupe_entries);
+    dedupe_entries = entries;
+    dedupe_max = max;
+}
+
+/* A new owner for one file's textures. */
+int32_t dedupe_begin (void)
+{
+    return atomic_add32 (&dedupe_owners, 1);
+}
+
+/*
+    Returns the path of an earlier texture with the same content, or NULL
+    if there's none. Then path, if given, is recorded as the first copy.
+    Another owner's copy that isn't written yet doesn't count, it's still
+    being written or its job failed, so the caller writes its own.
+*/
+const char *dedupe_claim (int32_t owner, uint64_t hash, int width, int height, const char *path)
+{
+    const char *original = NULL;
+    uint32_t run = io_get () ? io_get ()->run : 0;
+
+    mutex_lock (&dedupe_lock);
+
+    if (dedupe_count * 2 >= dedupe_max)
+        dedupe_rehash (dedupe_max ? dedupe_max * 2 : 1024, NULL);
+
+    dedupeentry_t *entry = dedupe_find (dedupe_entries, dedupe_max, hash, width, height, run);
+
+    if (entry->path)
+    {
+        if (entry->written || entry->owner == owner)
+            original = entry->path;
+    }
+    else if (path)
+    {
+        entry->hash = hash;
+        entry->width = width;
+        entry->height = height;
+        entry->run = run;
+        entry->owner = owner;
+        entry->written = false;
+        entry->path = strdup (path);
+        dedupe_count++;
+    }
+
+    mutex_unlock (&dedupe_lock);
+
+    return original;
+}
+
+/* Owner's copy is closed, other files can have it now. */
+void dedupe_written (int32_t owner, uint64_t hash, int width, int height)
+{
+    uint32_t run = io_get () ? io_get ()->run : 0;
+
+    mutex_lock (&dedupe_lock);
+
+    if (dedupe_max > 0)
+    {
+        dedupeentry_t *entry = dedupe_find (dedupe_entries, dedupe_max, hash, width, height, run);
+
+        if (entry->path && entry->owner == owner)
+            entry->written = true;
+    }
+
+    mutex_unlock (&dedupe_lock);
+}
+
+/* Drops a finished run's textures. */
+void dedupe_forget (uint32_t run)
+{
+    mutex_lock (&dedupe_lock);
+
+    if (dedupe_count > 0)
+        dedupe_rehash (dedupe_max, &run);
+
+    mutex_unlock (&dedupe_lock);
+}
+
+/* Hard link path to original, replacing whatever is there. */
+bool dedupe_link (const char *original, const char *path)
+{
+    qc_makepath (path);
+    remove (path);
+
+#ifdef _WIN32
+    return CreateHardLinkA (path, original, NULL) != 0;
+#else
+    return link (original, path) == 0;
+#endif
+}
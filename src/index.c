@@ -0,0 +1,297 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#include "studio.h"
+#include "thread.h"
+#include "wadlib.h"
+
+/*
+    Sidecar index of the textures in a WAD or BSP, kept as "<file>.idx". It is
+    rebuilt whenever the source file's size or modification time changes.
+*/
+
+#define IDINDEXHEADER (('X' << 24) + ('D' << 16) + ('I' << 8) + 'H')
+// little-endian "HIDX"
+
+#define INDEX_VERSION 3
+
+typedef struct
+{
+    int32_t ident;
+    int32_t version;
+    int64_t srcsize;
+    int64_t srcmtime; /* Nanoseconds, see filestamp_t. */
+    int32_t count;
+    int32_t pad;
+} texindexheader_t;
+
+/* Indexes this process already has, so a resident -serve doesn't read them again. */
+#define INDEX_MAXCACHED 64
+
+typedef struct
+{
+    char *idxname; /* NULL if the slot is free. */
+    filestamp_t src;
+    texindex_t *index;
+} indexcache_t;
+
+static mutex_t index_lock = MUTEX_INIT;
+static indexcache_t index_cache[INDEX_MAXCACHED];
+static int index_next = 0; /* Oldest slot, replaced once they're all taken. */
+
+uint32_t *decomp_miptexofs (mdlfile_t *file, bool wad, int *count, uint32_t **order);
+uint64_t decomp_miptexhash (mdlfile_t *file, uint32_t pixels, uint32_t width, uint32_t height);
+
+static texindex_t *index_load (const char *idxname, const filestamp_t *src)
+{
+    FILE *stream = fopen (idxname, "rb");
+
+    if (!stream)
+        return NULL;
+    
+    texindexheader_t header;
+    texindex_t *index = NULL;
+
+    if (fread (&header, sizeof (header), 1, stream) != 1
+        || header.ident != IDINDEXHEADER
+        || header.version != INDEX_VERSION
+        || header.srcsize != (int64_t)src->size
+        || header.srcmtime != src->mtime
+        || header.count < 0)
+    {
+        goto load_done;
+    }
+
+    index = (texindex_t *)memalloc (1, sizeof (*index));
+    index->count = header.count;
+    index->entries = (texindexentry_t *)memalloc (header.count > 0 ? header.count : 1, sizeof (*index->entries));
+
+    if (fread (index->entries, sizeof (*index->entries), header.count, stream) != (size_t)header.count)
+    {
+        index_free (index);
+        index = NULL;
+    }
+
+load_done:
+    fclose (stream);
+    return index;
+}
+
+static texindex_t *index_build (mdlfile_t *file, bool wad)
+{
+    texindex_t *index = (texindex_t *)memalloc (1, sizeof (*index));
+    scratchmark_t mark = scratch_mark ();
+    uint32_t *order;
+    uint32_t *offsets = decomp_miptexofs (file, wad, &index->count, &order);
+    texindexentry_t *entry;
+    miptex_t mip;
+    size_t area;
+    int i;
+
+    index->entries = (texindexentry_t *)memalloc (index->count > 0 ? index->count : 1, sizeof (*index->entries));
+
+    for (i = 0; i < index->count; ++i)
+    {
+        entry = &index->entries[i];
+
+        mdl_readat (file, offsets[i], &mip, sizeof (mip));
+        fixpath (mip.name, true);
+
+        area = (size_t)mip.width * mip.height;
+
+        memcpy (entry->name, mip.name, sizeof (mip.name));
+        entry->offset = offsets[i];
+        entry->order = order[i];
+        entry->pixels = offsets[i] + mip.offsets[0];
+        entry->width = mip.width;
+        entry->height = mip.height;
+        entry->size = mip.offsets[0] + area / 64 * 85 + sizeof (unsigned short) + 768;
+
+        entry->hash = decomp_miptexhash (file, entry->pixels, entry->width, entry->height);
+    }
+
+    scratch_release (mark);
+
+    return index;
+}
+
+static texindex_t *index_copy (const texindex_t *index)
+{
+    texindex_t *copy = (texindex_t *)memalloc (1, sizeof (*copy));
+
+    copy->count = index->count;
+    copy->entries = (texindexentry_t *)memalloc (index->count > 0 ? index->count : 1, sizeof (*copy->entries));
+    memcpy (copy->entries, index->entries, index->count * sizeof (*copy->entries));
+
+    return copy;
+}
+
+/* The caller's own copy, or NULL if it isn't cached or the source has changed since. */
+static texindex_t *index_cached (const char *idxname, const filestamp_t *src)
+{
+    texindex_t *index = NULL;
+    int i;
+
+    mutex_lock (&index_lock);
+
+    for (i = 0; i < INDEX_MAXCACHED; ++i)
+    {
+        indexcache_t *slot = &index_cache[i];
+
+        if (slot->idxname
+            && slot->src.size == src->size
+            && slot->src.mtime == src->mtime
+            && !strcmp (slot->idxname, idxname))
+        {
+            index = index_copy (slot->index);
+            break;
+        }
+    }
+
+    mutex_unlock (&index_lock);
+
+    return index;
+}
+
+static void index_remember (const char *idxname, const texindex_t *index, const filestamp_t *src)
+{
+    indexcache_t *slot = NULL;
+    int i;
+
+    mutex_lock (&index_lock);
+
+    /* An outdated copy of the same file is replaced in place. */
+    for (i = 0; i < INDEX_MAXCACHED; ++i)
+    {
+        if (index_cache[i].idxname && !strcmp (index_cache[i].idxname, idxname))
+        {
+            slot = &index_cache[i];
+            break;
+        }
+    }
+
+    if (!slot)
+    {
+        slot = &index_cache[index_next];
+        index_next = (index_next + 1) % INDEX_MAXCACHED;
+    }
+
+    if (slot->idxname)
+    {
+        free (slot->idxname);
+        index_free (slot->index);
+    }
+
+    slot->idxname = strdup (idxname);
+    slot->src = *src;
+    slot->index = index_copy (index);
+
+    mutex_unlock (&index_lock);
+}
+
+/* Written next to the source and renamed into place, a failure only costs the cache. */
+static void index_save (const char *idxname, const texindex_t *index, const filestamp_t *src)
+{
+    char *tmpname = (char *)memalloc (strlen (idxname) + 8, 1);
+    sprintf (tmpname, "%s.tmp", idxname);
+
+    FILE *stream = fopen (tmpname, "wb");
+
+    if (!stream)
+    {
+        msg_warning ("Warning: Can't write index \"%s\"\n", idxname);
+        free (tmpname);
+        return;
+    }
+
+    texindexheader_t header;
+    memset (&header, 0, sizeof (header));
+    header.ident = IDINDEXHEADER;
+    header.version = INDEX_VERSION;
+    header.srcsize = (int64_t)src->size;
+    header.srcmtime = src->mtime;
+    header.count = index->count;
+
+    bool ok = fwrite (&header, sizeof (header), 1, stream) == 1
+        && fwrite (index->entries, sizeof (*index->entries), index->count, stream) == (size_t)index->count;
+    
+    ok = (fclose (stream) == 0) && ok;
+
+#ifdef _WIN32
+    if (ok)
+        remove (idxname);
+#endif
+
+    if (!ok || rename (tmpname, idxname) != 0)
+    {
+        msg_warning ("Warning: Can't write index \"%s\"\n", idxname);
+        remove (tmpname);
+    }
+
+    free (tmpname);
+}
+
+texindex_t *index_open (const char *filename, mdlfile_t *file, bool wad)
+{
+    char *idxname = (char *)memalloc (strlen (filename) + 8, 1);
+    sprintf (idxname, "%s.idx", filename);
+
+    /* The file that was mapped, not whatever is at its path now. */
+    const filestamp_t *src = file->stamped ? &file->stamp : NULL;
+    bool havestat = src != NULL;
+    texindex_t *index = NULL;
+
+    if (havestat)
+    {
+        index = index_cached (idxname, src);
+
+        if (index)
+        {
+            msg_log (MSG_VERBOSE, "Using cached index \"%s\"\n", idxname);
+            free (idxname);
+            return index;
+        }
+
+        index = index_load (idxname, src);
+    }
+
+    if (!index)
+    {
+        msg_log (MSG_NORMAL, "Indexing \"%s\"...\n", filename);
+
+        index = index_build (file, wad);
+
+        if (havestat)
+            index_save (idxname, index, src);
+    }
+    else
+    {
+        msg_log (MSG_VERBOSE, "Using index \"%s\"\n", idxname);
+    }
+
+    if (havestat)
+        index_remember (idxname, index, src);
+
+    free (idxname);
+
+    return index;
+}
+
+void index_free (texindex_t *index)
+{
+    free (index->entries);
+    free (index);
+}
@@ -19,17 +19,56 @@ without written permission from Valve LLC.
 #include "wadlib.h"
 #include "bspfile.h"
 
+lumpinfo_t *decomp_wadlumps (mdlfile_t *wad, int type, int *count, uint32_t **order);
+
 enum {
     kInfoAct   = 1 << 0,
     kInfoEvent = 1 << 1,
     kInfoBody  = 1 << 2,
 };
 
-void info_mdl (const char *mdlname, const char *args)
+/* Texture listing of a WAD or BSP, answered from its index alone. */
+static void info_index (const char *filename, mdlfile_t *file, bool wad, char *args)
+{
+    texindex_t *index = index_open (filename, file, wad);
+    int i, total = 0;
+
+    if (args)
+    {
+        fixpath (args, true);
+    }
+
+    pattern_t *pattern = args ? pattern_compile (args) : NULL;
+
+    fprintf (stdout, "%i stored miptexs:\n", index->count);
+
+    for (i = 0; i < index->count; ++i)
+    {
+        if (args)
+        {
+            if (!pattern_match (pattern, index->entries[i].name))
+                continue;
+            
+            total++;
+        }
+
+        fprintf (stdout, "    %.16s\n", index->entries[i].name);
+    }
+
+    if (args)
+    {
+        fprintf (stdout, "%i results for \"%s\"\n", total, args);
+    }
+
+    pattern_free (pattern);
+    index_free (index);
+}
+
+void info_mdl (const char *mdlname, const char *args, bool useindex)
 {
     int id;
     int version;
-    FILE *mdl = mdl_open (mdlname, &id, &version, false);
+    mdlfile_t *mdl = mdl_open (mdlname, &id, &version, false);
 
     fprintf (stdout, "Identifier: \"%.4s\"\n", (char *)&id);
 
@@ -43,11 +82,12 @@ void info_mdl (const char *mdlname, const char *args)
             goto info_done;
         }
         
-        int32_t textureindex;
-        mdl_seek (mdl, offsetof (studiohdr_t, textureindex), SEEK_SET);
-        mdl_read (mdl, &textureindex, sizeof (textureindex));
+        const int32_t *textureindex = (const int32_t *)mdl_ptr (
+            mdl,
+            offsetof (studiohdr_t, textureindex),
+            sizeof (*textureindex));
 
-        if (textureindex == sizeof (studiohdr_t))
+        if (*textureindex == sizeof (studiohdr_t))
         {
             fprintf (stdout, "Valve MDL external texture group\n");
         }
@@ -74,11 +114,9 @@ void info_mdl (const char *mdlname, const char *args)
 
         fprintf (stdout, "Valve SPR\n");
 
-        dsprite_t header;
-        mdl_seek (mdl, 0, SEEK_SET);
-        mdl_read (mdl, &header, sizeof (header));
+        const dsprite_t *header = (const dsprite_t *)mdl_ptr (mdl, 0, sizeof (*header));
 
-        fprintf (stdout, "Sprite has %i frames, %i\u00d7%i pixels\n", header.numframes, header.width, header.height);
+        fprintf (stdout, "Sprite has %i frames, %i\u00d7%i pixels\n", header->numframes, header->width, header->height);
         
         goto info_done;
     }
@@ -86,12 +124,16 @@ void info_mdl (const char *mdlname, const char *args)
     {
         fprintf (stdout, "Valve WAD\n");
 
-        wadinfo_t info;
-        mdl_read (mdl, &info, sizeof (info));
+        if (useindex)
+        {
+            info_index (mdlname, mdl, true, args);
+            goto info_done;
+        }
 
-        int i, j;
+        int i, j, miptotal;
 
-        lumpinfo_t lumpinfo;
+        scratchmark_t mark = scratch_mark ();
+        lumpinfo_t *lumpinfo = decomp_wadlumps (mdl, TYP_MIPTEX, &miptotal, NULL);
         miptex_t mip;
 
         if (args)
@@ -99,55 +141,31 @@ void info_mdl (const char *mdlname, const char *args)
             fixpath (args, true);
         }
 
-        int miptotal = 0;
+        pattern_t *pattern = args ? pattern_compile (args) : NULL;
 
-        for (i = 0; i < info.numlumps; ++i)
-        {
-            mdl_seek (mdl, info.infotableofs + sizeof (lumpinfo) * i, SEEK_SET);
-            mdl_read (mdl, &lumpinfo, sizeof (lumpinfo));
-
-            switch (lumpinfo.type)
-            {
-            case TYP_MIPTEX:
-                miptotal++;
-                break;
-            default:
-                break;
-            }
-        }
-        
         fprintf (stdout, "%i stored miptexs:\n", miptotal);
 
         int total = 0;
 
-        for (i = 0; i < info.numlumps; ++i)
+        for (i = 0; i < miptotal; ++i)
         {
-            mdl_seek (mdl, info.infotableofs + sizeof (lumpinfo) * i, SEEK_SET);
-            mdl_read (mdl, &lumpinfo, sizeof (lumpinfo));
+            mdl_readat (mdl, lumpinfo[i].filepos, &mip, sizeof (mip));
+            fixpath (mip.name, true);
 
-            switch (lumpinfo.type)
+            if (args)
             {
-            case TYP_MIPTEX:
-                mdl_seek (mdl, lumpinfo.filepos, SEEK_SET);
-                mdl_read (mdl, &mip, sizeof (mip));
-                fixpath (mip.name, true);
-
-                if (args)
-                {
-                    if (!strstr (mip.name, args))
-                    {
-                        break;
-                    }
-                    total++;
-                }
-
-                fprintf (stdout, "    %.16s\n", mip.name);
-                break;
-            default:
-                break;
+                if (!pattern_match (pattern, mip.name))
+                    continue;
+                
+                total++;
             }
+
+            fprintf (stdout, "    %.16s\n", mip.name);
         }
 
+        scratch_release (mark);
+        pattern_free (pattern);
+
         if (args)
         {
             fprintf (stdout, "%i results for \"%s\"\n", total, args);
@@ -159,22 +177,35 @@ void info_mdl (const char *mdlname, const char *args)
     {
         fprintf (stdout, "Valve BSP\n");
 
+        if (useindex)
+        {
+            info_index (mdlname, mdl, false, args);
+            goto info_done;
+        }
+
         dheader_t header;
-        mdl_read (mdl, &header, sizeof (header));
+        mdl_readat (mdl, 0, &header, sizeof (header));
 
         int i, j;
 
         int32_t nummiptex;
         int32_t dataofs;
+        const int32_t *dataofss;
         miptex_t mip;
         
-        mdl_seek (mdl, header.lumps[LUMP_TEXTURES].fileofs, SEEK_SET);
-        mdl_read (mdl, &nummiptex, sizeof (nummiptex));
+        mdl_readat (mdl, header.lumps[LUMP_TEXTURES].fileofs, &nummiptex, sizeof (nummiptex));
+
+        dataofss = (const int32_t *)mdl_ptr (
+            mdl,
+            header.lumps[LUMP_TEXTURES].fileofs + sizeof (nummiptex),
+            sizeof (*dataofss) * nummiptex);
 
         if (args)
         {
             fixpath (args, true);
         }
+
+        pattern_t *pattern = args ? pattern_compile (args) : NULL;
         
         fprintf (stdout, "%i stored miptexs:\n", nummiptex);
 
@@ -182,18 +213,14 @@ void info_mdl (const char *mdlname, const char *args)
 
         for (i = 0; i < nummiptex; ++i)
         {
-            mdl_seek (mdl, header.lumps[LUMP_TEXTURES].fileofs + sizeof (nummiptex) + sizeof (dataofs) * i, SEEK_SET);
-            mdl_read (mdl, &dataofs, sizeof (dataofs));
+            dataofs = dataofss[i] + header.lumps[LUMP_TEXTURES].fileofs;
 
-            dataofs += header.lumps[LUMP_TEXTURES].fileofs;
-
-            mdl_seek (mdl, dataofs, SEEK_SET);
-            mdl_read (mdl, &mip, sizeof (mip));
+            mdl_readat (mdl, dataofs, &mip, sizeof (mip));
             fixpath (mip.name, true);
             
             if (args)
             {
-                if (!strstr (mip.name, args))
+                if (!pattern_match (pattern, mip.name))
                 {
                     continue;
                 }
@@ -203,6 +230,8 @@ void info_mdl (const char *mdlname, const char *args)
             fprintf (stdout, "    %.16s\n", mip.name);
         }
 
+        pattern_free (pattern);
+
         if (args)
         {
             fprintf (stdout, "%i results for \"%s\"\n", total, args);
@@ -240,69 +269,67 @@ void info_mdl (const char *mdlname, const char *args)
         }
     }
 
-    studiohdr_t header;
-    mdl_seek (mdl, 0, SEEK_SET);
-    mdl_read (mdl, &header, sizeof (header));
+    const studiohdr_t *header = (const studiohdr_t *)mdl_ptr (mdl, 0, sizeof (*header));
 
-    fprintf (stdout, "Stored name: \"%.64s\"\n", header.name);
+    fprintf (stdout, "Stored name: \"%.64s\"\n", header->name);
     
-    fprintf (stdout, "%i sequences:\n", header.numseq);
+    fprintf (stdout, "%i sequences:\n", header->numseq);
 
     int i, j;
-    mstudioseqdesc_t seq;
-    mstudioevent_t event;
+    const mstudioseqdesc_t *seq = (const mstudioseqdesc_t *)mdl_ptr (
+        mdl,
+        header->seqindex,
+        sizeof (*seq) * header->numseq);
+    const mstudioevent_t *event;
+    char custom[32];
     
-    for (i = 0; i < header.numseq; ++i)
+    for (i = 0; i < header->numseq; ++i)
     {
-        mdl_seek (mdl, header.seqindex + sizeof (seq) * i, SEEK_SET);
-        mdl_read (mdl, &seq, sizeof (seq));
-        
-        fprintf (stdout, "%4i : \"%s\"\n", i, seq.label);
+        fprintf (stdout, "%4i : \"%s\"\n", i, seq[i].label);
 
-        if (mode & kInfoAct && seq.activity > 0)
+        if (mode & kInfoAct && seq[i].activity > 0)
         {
-            fprintf (stdout, "    %s\n", mdl_getactname (seq.activity));
+            fprintf (stdout, "    %s\n", mdl_getactname (seq[i].activity, custom, sizeof (custom)));
         }
 
-        if (mode & kInfoEvent && seq.numevents > 0)
+        if (mode & kInfoEvent && seq[i].numevents > 0)
         {
-            fprintf (stdout, "    %i events:\n", seq.numevents);
+            fprintf (stdout, "    %i events:\n", seq[i].numevents);
 
-            mdl_seek (mdl, seq.eventindex, SEEK_SET);
+            event = (const mstudioevent_t *)mdl_ptr (mdl, seq[i].eventindex, sizeof (*event) * seq[i].numevents);
             
-            for (j = 0; j < seq.numevents; ++j)
+            for (j = 0; j < seq[i].numevents; ++j)
             {
-                mdl_read (mdl, &event, sizeof (event));
-                fprintf (stdout, "        %4i : %i\n", event.frame, event.event);
+                fprintf (stdout, "        %4i : %i\n", event[j].frame, event[j].event);
             }
         }
     }
     
     if (id != IDSTUDIOSEQHEADER && (mode & kInfoBody))
     {
-        fprintf (stdout, "Body groups (%i):\n", header.numbodyparts);
+        fprintf (stdout, "Body groups (%i):\n", header->numbodyparts);
 
-        mstudiobodyparts_t bodypart;
-        mstudiomodel_t model;
+        const mstudiobodyparts_t *bodypart = (const mstudiobodyparts_t *)mdl_ptr (
+            mdl,
+            header->bodypartindex,
+            sizeof (*bodypart) * header->numbodyparts);
+        const mstudiomodel_t *model;
 
-        for (i = 0; i < header.numbodyparts; ++i)
+        for (i = 0; i < header->numbodyparts; ++i)
         {
-            mdl_seek (mdl, header.bodypartindex + sizeof (bodypart) * i, SEEK_SET);
-            mdl_read (mdl, &bodypart, sizeof (bodypart));
-            fprintf (stdout, "%4i : \"%s\"\n", i, bodypart.name);
+            fprintf (stdout, "%4i : \"%s\"\n", i, bodypart[i].name);
 
-            mdl_seek (mdl, bodypart.modelindex, SEEK_SET);
+            model = (const mstudiomodel_t *)mdl_ptr (mdl, bodypart[i].modelindex, sizeof (*model) * bodypart[i].nummodels);
 
-            for (j = 0; j < bodypart.nummodels; ++j)
+            for (j = 0; j < bodypart[i].nummodels; ++j)
             {
-                mdl_read (mdl, &model, sizeof (model));
-                fprintf (stdout, "    %4i : \"%s\"\n", j, model.name);
+                fprintf (stdout, "    %4i : \"%s\"\n", j, model[j].name);
             }
         }
     }
 
 info_done:
-    fclose (mdl);
+    mdl_close (mdl);
 
     fprintf (stdout, "Done!\n");
 }
@@ -0,0 +1,287 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#include "studio.h"
+#include "thread.h"
+
+void decomp_mdl (
+    const char *mdlname,
+    const char *qcname,
+    const char *cd,
+    const char *cdtexture,
+    const char *cdanim,
+    const char *qcdir,
+    const char *smddir,
+    bool incremental);
+
+void decomp_spr (
+    const char *sprname,
+    const char *qcname,
+    const char *cd,
+    const char *qcdir,
+    const char *bmpdir);
+
+void decomp_wad (
+    const char *wadname,
+    const char *bmpdir,
+    const pattern_t *pattern,
+    bool useindex,
+    dedupe_t dedupe);
+
+void decomp_bsptex (
+    const char *bspname,
+    const char *bmpdir,
+    const pattern_t *pattern,
+    bool useindex,
+    dedupe_t dedupe);
+
+static const decomp_options_t decomp_defaults = {NULL, NULL, NULL, NULL, 0, DECOMP_DEDUPE_NONE, 0};
+
+/* One decomp_path or decomp_buffer call, run as a job so errors come back as codes. */
+typedef struct
+{
+    char *in;
+    char *out;
+    const decomp_options_t *options;
+    pattern_t *pattern;
+
+    /* Freed by decomp_run, so they don't leak if the job aborts. */
+    char *qcdir;
+    char *qcname;
+    char *smddir;
+} decompjob_t;
+
+static void getdirs (
+    char *in,
+    char *out,
+    char **qcdir,
+    char **qcname,
+    bool havecd)
+{
+    if (havecd)
+    {
+        *qcdir = ".";
+    }
+
+    if (!out) /* Put files in sub directory. */
+    {
+        *qcname = strdup (skippath (in));
+        stripext (*qcname);
+
+        if (!havecd)
+        {
+            *qcdir = strdup (*qcname);
+        }
+        return;
+    }
+
+    char *name, *ext;
+    
+    /* Ending in a slash, it's a directory whatever it looks like. */
+    filebase (out, &name, &ext);
+    
+    if (*ext) /* QC name provided. Put files in root directory. */
+    {
+        *qcname = strdup (out);
+        stripext (*qcname);
+
+        if (!havecd)
+        {
+            *qcdir = strdup (out);
+            stripfilename (*qcdir);
+        }
+    }
+    else /* Put files in sub directory. */
+    {
+        *qcname = strdup (skippath (in));
+        stripext (*qcname);
+
+        if (!havecd)
+        {
+            *qcdir = appenddir (out, *qcname);
+        }
+    }
+}
+
+static void decomp_job (void *arg)
+{
+    decompjob_t *job = (decompjob_t *)arg;
+    const decomp_options_t *opts = job->options;
+    bool havecd = opts->cd != NULL;
+    char *cd = havecd ? (char *)opts->cd : ".";
+    char *cdtexture = (char *)opts->cdtexture;
+    char *cdanim = (char *)opts->cdanim;
+    char *in = job->in;
+    char *qcdir, *qcname, *smddir;
+    statsphase_t phase = stats_begin (STATS_HEADER);
+
+    trace_begin ("file", in);
+
+    getdirs (in, job->out, &qcdir, &qcname, havecd);
+    job->qcdir = havecd ? NULL : qcdir;
+    job->qcname = qcname;
+
+    smddir = job->smddir = appenddir (qcdir, cd);
+
+    char *name, *ext;
+    filebase (in, &name, &ext);
+    if (!strcasecmp (ext, ".spr"))
+    {
+        if (cdtexture == NULL)
+            cdtexture = "./bmp";
+
+        char *bmpdir = scratch_appenddir (qcdir, cdtexture);
+        decomp_spr (in, skippath (qcname), cdtexture, qcdir, bmpdir);
+    }
+    else if (!strcasecmp (ext, ".wad"))
+    {
+        if (cdtexture == NULL)
+            cdtexture = "./bmp";
+
+        char *bmpdir = scratch_appenddir (qcdir, cdtexture);
+        decomp_wad (in, bmpdir, job->pattern, opts->index, (dedupe_t)opts->dedupe);
+    }
+    else if (!strcasecmp (ext, ".bsp"))
+    {
+        if (cdtexture == NULL)
+            cdtexture = "./bmp";
+
+        char *bmpdir = scratch_appenddir (qcdir, cdtexture);
+        decomp_bsptex (in, bmpdir, job->pattern, opts->index, (dedupe_t)opts->dedupe);
+    }
+    else
+    {
+        if (cdtexture == NULL)
+            cdtexture = "./maps_8bit";
+        
+        if (cdanim == NULL)
+            cdanim = "./anims";
+        
+        decomp_mdl (in, skippath (qcname), cd, cdtexture, cdanim, qcdir, smddir, opts->incremental);
+    }
+
+    trace_end ();
+    stats_end (phase);
+}
+
+static int decomp_run (const char *in, const char *out, const decomp_options_t *options, iocontext_t *ctx)
+{
+    decompjob_t job;
+
+    if (!options)
+        options = &decomp_defaults;
+
+    if (options->dedupe < DECOMP_DEDUPE_NONE || options->dedupe > DECOMP_DEDUPE_MANIFEST)
+        return DECOMP_EINVAL;
+
+    /* The decompilers may modify the names in place. */
+    job.in = strdup (in);
+    job.out = out ? strdup (out) : NULL;
+    job.options = options;
+    job.pattern = options->pattern ? pattern_compile (options->pattern) : NULL;
+    job.qcdir = job.qcname = job.smddir = NULL;
+
+    iocontext_t *prev = io_set (ctx);
+    int code = job_run (decomp_job, &job);
+    io_set (prev);
+
+    pattern_free (job.pattern);
+    free (job.smddir);
+    free (job.qcname);
+    free (job.qcdir);
+    free (job.out);
+    free (job.in);
+
+    return code;
+}
+
+int decomp_init (int numthreads)
+{
+    if (numthreads < 0)
+        return DECOMP_EINVAL;
+
+    pool_init (numthreads > 0 ? numthreads : thread_numcores ());
+
+    return DECOMP_OK;
+}
+
+void decomp_shutdown (void)
+{
+    pool_shutdown ();
+    scratch_shutdown ();
+}
+
+void decomp_threaddone (void)
+{
+    stats_threaddone ();
+    scratch_shutdown ();
+}
+
+void decomp_setlevel (int level)
+{
+    msg_setlevel (level);
+}
+
+int decomp_path (const char *in, const char *out, const decomp_options_t *options, const decomp_report_t *report)
+{
+    if (!in)
+        return DECOMP_EINVAL;
+
+    if (!report)
+        return decomp_run (in, out, options, NULL);
+
+    /* Part of the caller's -serve request, if it's one. */
+    iocontext_t *prev = io_get ();
+    iocontext_t ctx = {NULL, report, NULL, NULL, 0, prev ? prev->run : 0};
+
+    return decomp_run (in, out, options, &ctx);
+}
+
+int decomp_buffer (
+    const char *name,
+    const void *data,
+    size_t size,
+    const char *out,
+    const decomp_options_t *options,
+    const decomp_io_t *io)
+{
+    if (!name || (!data && size > 0))
+        return DECOMP_EINVAL;
+
+    if (!io || !io->open || !io->write || !io->close)
+        return DECOMP_EINVAL;
+
+    /* These keep state on disk next to the input. */
+    if (options && (options->index || options->dedupe != DECOMP_DEDUPE_NONE || options->incremental))
+        return DECOMP_EINVAL;
+
+    iocontext_t ctx = {io, NULL, name, data, size, 0};
+
+    return decomp_run (name, out, options, &ctx);
+}
+
+const char *decomp_strerror (int code)
+{
+    switch (code)
+    {
+    case DECOMP_OK: return "Success";
+    case DECOMP_EINVAL: return "Invalid argument";
+    case DECOMP_EREAD: return "Input not found";
+    case DECOMP_EFORMAT: return "Bad input";
+    case DECOMP_EWRITE: return "Output failed";
+    }
+    return "Decompile failed";
+}
@@ -0,0 +1,131 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#ifndef _LIBDECOMP_H
+#define _LIBDECOMP_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Returned by every call. */
+#define DECOMP_OK 0
+#define DECOMP_EFAILED 1 /* Anything else, the DECOMP_MSG_ERROR message says what. */
+#define DECOMP_EINVAL 2  /* Bad arguments. */
+#define DECOMP_EREAD 3   /* An input, or a file it refers to, couldn't be read. */
+#define DECOMP_EFORMAT 4 /* An input isn't what its name says, or is damaged. */
+#define DECOMP_EWRITE 5  /* An output couldn't be created or written. */
+
+/* Message levels, the first three as -q, the default and -v show them. */
+#define DECOMP_MSG_RESULT 0
+#define DECOMP_MSG_INFO 1
+#define DECOMP_MSG_DETAIL 2
+#define DECOMP_MSG_WARNING 3
+#define DECOMP_MSG_ERROR 4
+
+/* What -dedupe does with a texture already extracted this run. */
+#define DECOMP_DEDUPE_NONE 0
+#define DECOMP_DEDUPE_SKIP 1
+#define DECOMP_DEDUPE_LINK 2
+#define DECOMP_DEDUPE_MANIFEST 3
+
+/* Zeroed, or a NULL pointer, is the command line's defaults. */
+typedef struct
+{
+	const char *cd;        /* Data path, see -cd. */
+	const char *cdtexture; /* "./maps_8bit" for models and "./bmp" for the rest if NULL. */
+	const char *cdanim;    /* "./anims" if NULL. */
+	const char *pattern;   /* WAD & BSP textures to extract, as -pattern. All if NULL. */
+
+	/* Kept on disk between runs, decomp_path only. */
+	int index;             /* See -index. */
+	int dedupe;            /* DECOMP_DEDUPE_*, see -dedupe. */
+	int incremental;       /* See -incremental. */
+} decomp_options_t;
+
+/*
+    Where decomp_buffer reads & writes. Callbacks may be made from worker
+    threads, several at once for different files, but a file's own calls
+    are never concurrent. Paths are what would be written on disk.
+*/
+typedef struct
+{
+	void *user; /* Passed back to every callback. */
+
+	/*
+	    Fetches a file the input refers to, a model's "<name>t.mdl" textures or
+	    "<name>01.mdl" sequence groups. Sets data & size, which must stay valid
+	    until decomp_buffer returns, and returns 0. May be NULL if there's none.
+	*/
+	int (*read) (void *user, const char *path, const void **data, size_t *size);
+
+	/* Starts an output, returns its handle, or NULL on failure. */
+	void *(*open) (void *user, const char *path);
+
+	/* Appends to an output, returns 0 on success. */
+	int (*write) (void *user, void *file, const void *data, size_t size);
+
+	/* Ends an output, failed if the decompile was aborted with it partly written. Returns 0 on success. */
+	int (*close) (void *user, void *file, int failed);
+
+	/* Progress, warnings & errors, DECOMP_MSG_DETAIL only after decomp_setlevel. May be NULL. */
+	void (*message) (void *user, int level, const char *text);
+} decomp_io_t;
+
+/* What decomp_path did, instead of the console. Callbacks may be made from worker threads. */
+typedef struct
+{
+	void *user; /* Passed back to every callback. */
+	void (*output) (void *user, const char *path);              /* A file was written. May be NULL. */
+	void (*message) (void *user, int level, const char *text); /* As decomp_io_t's. May be NULL. */
+} decomp_report_t;
+
+/* Starts the worker threads, 0 for one per CPU core. Optional, without it everything runs on the caller's thread. */
+int decomp_init (int numthreads);
+void decomp_shutdown (void);
+
+/* Each calling thread keeps working memory between calls, a thread that's done with them frees it. */
+void decomp_threaddone (void);
+
+/* The most detailed DECOMP_MSG_RESULT..DECOMP_MSG_DETAIL message passed on, DECOMP_MSG_INFO by default. */
+void decomp_setlevel (int level);
+
+/*
+    Decompiles a model, sprite, WAD or BSP, picked by its extension. Files
+    go where the command line puts them, out is the same optional output
+    directory or QC name. May be called from several threads at once.
+    Messages go to the console if report is NULL.
+*/
+int decomp_path (const char *in, const char *out, const decomp_options_t *options, const decomp_report_t *report);
+
+/* The same from memory, name stands in for the input's path. */
+int decomp_buffer (
+	const char *name,
+	const void *data,
+	size_t size,
+	const char *out,
+	const decomp_options_t *options,
+	const decomp_io_t *io);
+
+const char *decomp_strerror (int code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LIBDECOMP_H */
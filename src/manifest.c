@@ -0,0 +1,248 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#include "studio.h"
+#include "thread.h"
+
+/*
+    -incremental keeps "<qc>.manifest" next to the QC, one line per generated
+    SMD or BMP with a hash of what was written, a hash of the inputs it was
+    made from, and its size & modification time. An output whose inputs hash
+    the same and whose size & time on disk haven't changed is left alone on
+    the next run, without reading it.
+*/
+
+#define MANIFEST_HEADER "decompmdl manifest 2"
+
+typedef struct
+{
+    uint64_t output;
+    uint64_t inputs;
+    filestamp_t stamp;
+    char *path;
+} manifestentry_t;
+
+struct manifest_s
+{
+    char *filepath;
+    char *filename;
+
+    /* From the last run, sorted by path. */
+    int numold;
+    manifestentry_t *old;
+
+    /* This run, filled in by the pool as outputs are written or kept. */
+    mutex_t lock;
+    int numnew;
+    int maxnew;
+    manifestentry_t *new;
+};
+
+static int manifest_compare (const void *a, const void *b)
+{
+    return strcmp (((const manifestentry_t *)a)->path, ((const manifestentry_t *)b)->path);
+}
+
+uint64_t manifest_hashinput (mdlfile_t *file)
+{
+    return hash64 (file->data, file->size, 0);
+}
+
+manifest_t *manifest_open (const char *filepath, const char *filename)
+{
+    manifest_t *manifest = (manifest_t *)memalloc (1, sizeof (*manifest));
+    char *name = qc_makename (filepath, filename, "manifest");
+    FILE *stream = fopen (name, "r");
+    char line[1024];
+
+    manifest->filepath = strdup (filepath);
+    manifest->filename = strdup (filename);
+    mutex_init (&manifest->lock);
+
+    free (name);
+
+    if (!stream)
+        return manifest;
+
+    /* Anything unexpected only costs a full rebuild. */
+    if (fgets (line, sizeof (line), stream) && !strncmp (line, MANIFEST_HEADER "\n", sizeof (line)))
+    {
+        int max = 0;
+        unsigned long long output, inputs, size;
+        long long mtime;
+        int pathofs;
+
+        while (fgets (line, sizeof (line), stream))
+        {
+            line[strcspn (line, "\r\n")] = '\0';
+
+            if (sscanf (line, "%16llx %16llx %llu %lld %n", &output, &inputs, &size, &mtime, &pathofs) != 4 || line[pathofs] == '\0')
+                continue;
+            
+            if (manifest->numold == max)
+            {
+                max = max ? max * 2 : 64;
+                manifest->old = (manifestentry_t *)realloc (manifest->old, max * sizeof (*manifest->old));
+
+                if (!manifest->old)
+                    error (1, "Failed to allocate %i bytes\n", max * sizeof (*manifest->old));
+            }
+
+            manifest->old[manifest->numold].output = output;
+            manifest->old[manifest->numold].inputs = inputs;
+            manifest->old[manifest->numold].stamp.size = size;
+            manifest->old[manifest->numold].stamp.mtime = mtime;
+            manifest->old[manifest->numold].path = strdup (line + pathofs);
+            manifest->numold++;
+        }
+
+        qsort (manifest->old, manifest->numold, sizeof (*manifest->old), manifest_compare);
+    }
+
+    fclose (stream);
+
+    return manifest;
+}
+
+static void manifest_add (manifest_t *manifest, uint64_t output, uint64_t inputs, const filestamp_t *stamp, char *path)
+{
+    mutex_lock (&manifest->lock);
+
+    if (manifest->numnew == manifest->maxnew)
+    {
+        manifest->maxnew = manifest->maxnew ? manifest->maxnew * 2 : 64;
+        manifest->new = (manifestentry_t *)realloc (manifest->new, manifest->maxnew * sizeof (*manifest->new));
+
+        if (!manifest->new)
+        {
+            mutex_unlock (&manifest->lock);
+            error (1, "Failed to allocate %i bytes\n", manifest->maxnew * sizeof (*manifest->new));
+        }
+    }
+
+    manifest->new[manifest->numnew].output = output;
+    manifest->new[manifest->numnew].inputs = inputs;
+    manifest->new[manifest->numnew].stamp = *stamp;
+    manifest->new[manifest->numnew].path = path;
+    manifest->numnew++;
+
+    mutex_unlock (&manifest->lock);
+}
+
+/*
+    True if the output is up to date, and is kept as is. Always false without
+    a manifest. If not, the output this thread opens next is hashed into hash,
+    for manifest_record.
+*/
+bool manifest_skip (manifest_t *manifest, const char *filepath, const char *filename, const char *ext, uint64_t inputs, uint64_t *hash)
+{
+    if (!manifest)
+        return false;
+
+    manifestentry_t key;
+    key.path = qc_makename (filepath, filename, ext);
+
+    const manifestentry_t *entry = (const manifestentry_t *)bsearch (
+        &key,
+        manifest->old,
+        manifest->numold,
+        sizeof (*manifest->old),
+        manifest_compare);
+    filestamp_t stamp;
+
+    if (!entry
+        || entry->inputs != inputs
+        || !file_stamp (key.path, &stamp)
+        || stamp.size != entry->stamp.size
+        || stamp.mtime != entry->stamp.mtime)
+    {
+        free (key.path);
+        qc_hashnext (hash);
+        return false;
+    }
+
+    msg_log (MSG_NORMAL, "Unchanged \"%s\"\n", key.path);
+
+    manifest_add (manifest, entry->output, inputs, &stamp, key.path);
+
+    return true;
+}
+
+/* Note down an output that was just written, hash is what manifest_skip set up. */
+void manifest_record (manifest_t *manifest, const char *filepath, const char *filename, const char *ext, uint64_t inputs, uint64_t hash)
+{
+    if (!manifest)
+        return;
+
+    char *path = qc_makename (filepath, filename, ext);
+    filestamp_t stamp;
+
+    if (!file_stamp (path, &stamp))
+    {
+        free (path);
+        error (DECOMP_EWRITE, "Output missing after it was written\n");
+    }
+
+    manifest_add (manifest, hash, inputs, &stamp, path);
+}
+
+static void manifest_free (manifestentry_t *entries, int count)
+{
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        free (entries[i].path);
+    }
+
+    free (entries);
+}
+
+/* Writes this run's manifest, sorted so it diffs cleanly. */
+void manifest_close (manifest_t *manifest)
+{
+    int i;
+
+    if (!manifest)
+        return;
+
+    qsort (manifest->new, manifest->numnew, sizeof (*manifest->new), manifest_compare);
+
+    qcfile_t *stream = qc_open (manifest->filepath, manifest->filename, "manifest", false);
+
+    qc_write (stream, MANIFEST_HEADER);
+
+    for (i = 0; i < manifest->numnew; ++i)
+    {
+        qc_writef (
+            stream,
+            "%016llx %016llx %llu %lld %s",
+            (unsigned long long)manifest->new[i].output,
+            (unsigned long long)manifest->new[i].inputs,
+            (unsigned long long)manifest->new[i].stamp.size,
+            (long long)manifest->new[i].stamp.mtime,
+            manifest->new[i].path);
+    }
+
+    qc_close (stream);
+
+    mutex_destroy (&manifest->lock);
+    manifest_free (manifest->old, manifest->numold);
+    manifest_free (manifest->new, manifest->numnew);
+    free (manifest->filepath);
+    free (manifest->filename);
+    free (manifest);
+}
@@ -15,6 +15,10 @@ without written permission from Valve LLC.
 */
 
 #include <math.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MATH_SSE2
+#endif
 
 #include "studio.h"
 
@@ -96,3 +100,79 @@ void vectorrotate(const vec3_t in1, const mat4x3_t in2, vec3_t out)
 	out[1] = dot (in1, in2[1]);
 	out[2] = dot (in1, in2[2]);
 }
+
+/*
+	Transform 4 vectors per step, same operations in the same order as
+	vectortransform/vectorrotate, so the results match them bit for bit.
+*/
+static void vectorbatch (const vec3_t *in, int count, const mat4x3_t mat, vec3_t *out, bool translate)
+{
+	int i = 0;
+
+#ifdef MATH_SSE2
+	__m128 m[3][4];
+	__m128 a, b, c, p, q, x, y, z, o[3];
+	int j, k;
+
+	for (j = 0; j < 3; ++j)
+	{
+		for (k = 0; k < 4; ++k)
+		{
+			m[j][k] = _mm_set1_ps (mat[j][k]);
+		}
+	}
+
+	for (; i + 4 <= count; i += 4)
+	{
+		/* x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3 */
+		a = _mm_loadu_ps (in[i]);
+		b = _mm_loadu_ps (in[i] + 4);
+		c = _mm_loadu_ps (in[i] + 8);
+
+		x = _mm_shuffle_ps (a, _mm_shuffle_ps (b, c, _MM_SHUFFLE (1, 1, 2, 2)), _MM_SHUFFLE (2, 0, 3, 0));
+		p = _mm_shuffle_ps (a, b, _MM_SHUFFLE (0, 0, 1, 1));
+		q = _mm_shuffle_ps (b, c, _MM_SHUFFLE (2, 2, 3, 3));
+		y = _mm_shuffle_ps (p, q, _MM_SHUFFLE (2, 0, 2, 0));
+		p = _mm_shuffle_ps (a, b, _MM_SHUFFLE (1, 1, 2, 2));
+		q = _mm_shuffle_ps (c, c, _MM_SHUFFLE (3, 3, 0, 0));
+		z = _mm_shuffle_ps (p, q, _MM_SHUFFLE (2, 0, 2, 0));
+
+		for (j = 0; j < 3; ++j)
+		{
+			o[j] = _mm_add_ps (_mm_add_ps (_mm_mul_ps (x, m[j][0]), _mm_mul_ps (y, m[j][1])), _mm_mul_ps (z, m[j][2]));
+
+			if (translate)
+				o[j] = _mm_add_ps (o[j], m[j][3]);
+		}
+
+		/* Back to x y z triples. */
+		p = _mm_shuffle_ps (o[0], o[1], _MM_SHUFFLE (0, 0, 0, 0));
+		q = _mm_shuffle_ps (o[2], o[0], _MM_SHUFFLE (1, 1, 0, 0));
+		_mm_storeu_ps (out[i], _mm_shuffle_ps (p, q, _MM_SHUFFLE (2, 0, 2, 0)));
+		p = _mm_shuffle_ps (o[1], o[2], _MM_SHUFFLE (1, 1, 1, 1));
+		q = _mm_shuffle_ps (o[0], o[1], _MM_SHUFFLE (2, 2, 2, 2));
+		_mm_storeu_ps (out[i] + 4, _mm_shuffle_ps (p, q, _MM_SHUFFLE (2, 0, 2, 0)));
+		p = _mm_shuffle_ps (o[2], o[0], _MM_SHUFFLE (3, 3, 2, 2));
+		q = _mm_shuffle_ps (o[1], o[2], _MM_SHUFFLE (3, 3, 3, 3));
+		_mm_storeu_ps (out[i] + 8, _mm_shuffle_ps (p, q, _MM_SHUFFLE (2, 0, 2, 0)));
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		if (translate)
+			vectortransform (in[i], mat, out[i]);
+		else
+			vectorrotate (in[i], mat, out[i]);
+	}
+}
+
+void vectortransformbatch (const vec3_t *in, int count, const mat4x3_t mat, vec3_t *out)
+{
+	vectorbatch (in, count, mat, out, true);
+}
+
+void vectorrotatebatch (const vec3_t *in, int count, const mat4x3_t mat, vec3_t *out)
+{
+	vectorbatch (in, count, mat, out, false);
+}
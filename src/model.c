@@ -18,7 +18,7 @@ without written permission from Valve LLC.
 
 static void decomp_bonetransform (
     studiohdr_t *header,
-    mstudiobone_t *bones,
+    const mstudiobone_t *bones,
     mat4x3_t *bone_transform)
 {
     int i;
@@ -46,114 +46,125 @@ static void decomp_bonetransform (
 }
 
 static void decomp_writeskeleton (
-    FILE *mdl,
-    FILE *smd,
+    smdfile_t *smd,
     studiohdr_t *header,
-    mstudiobone_t *bones,
+    const mstudiobone_t *bones,
     int time)
 {
-    qc_writef (smd, "  time %i", time);
+    smd_writetime (smd, time);
 
     int i;
 
     for (i = 0; i < header->numbones; ++i)
     {
-        qc_writef (
-            smd,
-            "    %i %.06f %.06f %.06f %.06f %.06f %.06f",
-            i,
-            bone_print(bones[i].value));
+        smd_writebone (smd, i, bones[i].value, bones[i].value + 3);
+    }
+}
+
+/*
+    Move every vertex or normal into world space once, a run of vectors
+    sharing a bone at a time, instead of once per triangle corner.
+*/
+static vec3_t *decomp_transformverts (
+    const vec3_t *in,
+    const byte *in_bones,
+    int count,
+    mat4x3_t *bone_transform,
+    bool translate)
+{
+    vec3_t *out = (vec3_t *)scratch_alloc (count > 0 ? count : 1, sizeof (*out));
+    int i, j;
+
+    for (i = 0; i < count; i = j)
+    {
+        for (j = i + 1; j < count && in_bones[j] == in_bones[i]; ++j)
+            ;
+        
+        if (translate)
+            vectortransformbatch (in + i, j - i, bone_transform[in_bones[i]], out + i);
+        else
+            vectorrotatebatch (in + i, j - i, bone_transform[in_bones[i]], out + i);
     }
+
+    return out;
 }
 
 static void decomp_writevert (
-    FILE *smd,
-    byte *vert_bones,
-    byte *norm_bones,
-    vec3_t *verts,
-    vec3_t *norms,
+    smdfile_t *smd,
+    const byte *vert_bones,
+    const vec3_t *verts,
+    const vec3_t *norms,
     float s,
     float t,
-    short *cmd,
-    mat4x3_t *bone_transform)
+    const short *cmd)
 {
-    byte vert_bone = vert_bones[cmd[0]];
-    byte norm_bone = norm_bones[cmd[1]];
-    vec3_t vert;
-    vec3_t norm;
-
-    vectortransform (verts[cmd[0]], bone_transform[vert_bone], vert);
-    vectorrotate (norms[cmd[1]], bone_transform[norm_bone], norm);
-
     s = cmd[2] * s;
     t = 1.0F - cmd[3] * t;
     
-    qc_writef (
-        smd,
-        "    %i %.04f %.04f %.04f %.04f %.04f %.04f %.04f %.04f",
-        vert_bone,
-        vec3_print (vert),
-        vec3_print (norm),
-        s,
-        t);
+    smd_writevert (smd, vert_bones[cmd[0]], verts[cmd[0]], norms[cmd[1]], s, t);
+}
+
+static const short *decomp_trimesh (mdlfile_t *mdl, int *triindex, int count)
+{
+    const short *ptr = (const short *)mdl_ptr (mdl, *triindex, sizeof (*ptr) * count);
+    *triindex += sizeof (*ptr) * count;
+    return ptr;
 }
 
 static void decomp_mesh (
-    FILE *mdl,
-    FILE *smd,
-    vec3_t *verts,
-    vec3_t *norms,
-    byte *vert_bones,
-    byte *norm_bones,
+    mdlfile_t *mdl,
+    smdfile_t *smd,
+    const vec3_t *verts,
+    const vec3_t *norms,
+    const byte *vert_bones,
     studiohdr_t *header,
-    mstudiomesh_t *mesh,
-    mstudiotexture_t *texture,
-    mstudiobone_t *bones,
-    mat4x3_t *bone_transform)
+    int triindex,
+    const modeltexture_t *texture)
 {
-    float s = 1.0F / texture->width;
-    float t = 1.0F / texture->height;
+    float s = texture->invwidth;
+    float t = texture->invheight;
     
     short c;
-    short cmd1[4], cmd2[4], cmd3[4];
+    const short *cmd1, *cmd2, *cmd3;
     bool flip;
 
     while (true)
     {
-        mdl_read (mdl, &c, sizeof (c));
+        c = *decomp_trimesh (mdl, &triindex, 1);
         
         if (c == 0)
             break;
 
-        mdl_read (mdl, cmd1, sizeof (cmd1));
-        mdl_read (mdl, cmd2, sizeof (cmd1));
-        mdl_read (mdl, cmd3, sizeof (cmd1));
+        /* A strip or fan of n vertices is n - 2 triangles. */
+        STATS_COUNT (STATS_TRIANGLES, (c < 0 ? -c : c) - 2);
+
+        cmd1 = decomp_trimesh (mdl, &triindex, 4);
+        cmd2 = decomp_trimesh (mdl, &triindex, 4);
+        cmd3 = decomp_trimesh (mdl, &triindex, 4);
 
         if (c < 0) /* Triangle fan */
         {
             for (c = -c - 2; c > 0; c--)
             {
-                qc_writef (smd, "%s.bmp", skippath (texture->name));
+                smd_puts (smd, texture->base);
+                smd_write (smd, ".bmp");
 
                 decomp_writevert (
-                    smd, vert_bones, norm_bones,
-                    verts, norms, s, t, cmd1,
-                    bone_transform);
+                    smd, vert_bones, verts, norms,
+                    s, t, cmd1);
                 
                 decomp_writevert (
-                    smd, vert_bones, norm_bones,
-                    verts, norms, s, t, cmd3,
-                    bone_transform);
+                    smd, vert_bones, verts, norms,
+                    s, t, cmd3);
                 
                 decomp_writevert (
-                    smd, vert_bones, norm_bones,
-                    verts, norms, s, t, cmd2,
-                    bone_transform);
+                    smd, vert_bones, verts, norms,
+                    s, t, cmd2);
                 
-                memcpy (cmd2, cmd3, sizeof (cmd1));
+                cmd2 = cmd3;
                 
                 if (c > 1)
-                    mdl_read (mdl, cmd3, sizeof (cmd1));
+                    cmd3 = decomp_trimesh (mdl, &triindex, 4);
             }
         }
         else /* Triangle strip */
@@ -161,138 +172,110 @@ static void decomp_mesh (
             flip = false;
             for (c -= 2; c > 0; c--)
             {
-                qc_writef (smd, "%s.bmp", skippath (texture->name));
+                smd_puts (smd, texture->base);
+                smd_write (smd, ".bmp");
                 
                 flip = !flip;
 
                 decomp_writevert (
-                    smd, vert_bones, norm_bones,
-                    verts, norms, s, t, flip ? cmd2 : cmd1,
-                    bone_transform);
+                    smd, vert_bones, verts, norms,
+                    s, t, flip ? cmd2 : cmd1);
                 
                 decomp_writevert (
-                    smd, vert_bones, norm_bones,
-                    verts, norms, s, t, flip ? cmd1 : cmd2,
-                    bone_transform);
+                    smd, vert_bones, verts, norms,
+                    s, t, flip ? cmd1 : cmd2);
                 
                 decomp_writevert (
-                    smd, vert_bones, norm_bones,
-                    verts, norms, s, t, cmd3,
-                    bone_transform);
+                    smd, vert_bones, verts, norms,
+                    s, t, cmd3);
                 
-                memcpy (cmd1, cmd2, sizeof (cmd1));
-                memcpy (cmd2, cmd3, sizeof (cmd1));
+                cmd1 = cmd2;
+                cmd2 = cmd3;
 
                 if (c > 1)
-                    mdl_read (mdl, cmd3, sizeof (cmd1));
+                    cmd3 = decomp_trimesh (mdl, &triindex, 4);
             }
         }
     }
 }
 
 static void decomp_meshes (
-    FILE *mdl,
-    FILE *tex,
-    FILE *smd,
+    mdlfile_t *mdl,
+    const texturetable_t *textures,
+    smdfile_t *smd,
     studiohdr_t *header,
-    studiohdr_t *textureheader,
     mstudiomodel_t *model,
-    mstudiobone_t *bones,
     mat4x3_t *bone_transform)
 {
     int i;
-    mstudiomesh_t mesh;
-    mstudiotexture_t texture;
-    short skin;
-
-    vec3_t *verts = (vec3_t *)memalloc (model->numverts, sizeof (*verts));
-    vec3_t *norms = (vec3_t *)memalloc (model->numnorms, sizeof (*norms));
-    byte *vert_bones = (byte *)memalloc (model->numverts, 1);
-    byte *norm_bones = (byte *)memalloc (model->numnorms, 1);
 
-    mdl_seek (mdl, model->vertindex, SEEK_SET);
-    mdl_read (mdl, verts, model->numverts * sizeof (*verts));
+    scratchmark_t mark = scratch_mark ();
+    const vec3_t *verts = (const vec3_t *)mdl_ptr (mdl, model->vertindex, model->numverts * sizeof (*verts));
+    const vec3_t *norms = (const vec3_t *)mdl_ptr (mdl, model->normindex, model->numnorms * sizeof (*norms));
+    const byte *vert_bones = (const byte *)mdl_ptr (mdl, model->vertinfoindex, model->numverts);
+    const byte *norm_bones = (const byte *)mdl_ptr (mdl, model->norminfoindex, model->numnorms);
+    const mstudiomesh_t *meshes = (const mstudiomesh_t *)mdl_ptr (mdl, model->meshindex, model->nummesh * sizeof (*meshes));
 
-    mdl_seek (mdl, model->normindex, SEEK_SET);
-    mdl_read (mdl, norms, model->numnorms * sizeof (*norms));
+    trace_begin ("decode", "decode");
+    vec3_t *world_verts = decomp_transformverts (verts, vert_bones, model->numverts, bone_transform, true);
+    vec3_t *world_norms = decomp_transformverts (norms, norm_bones, model->numnorms, bone_transform, false);
+    trace_end ();
 
-    mdl_seek (mdl, model->vertinfoindex, SEEK_SET);
-    mdl_read (mdl, vert_bones, model->numverts);
+    STATS_COUNT (STATS_VERTICES, model->numverts);
 
-    mdl_seek (mdl, model->norminfoindex, SEEK_SET);
-    mdl_read (mdl, norm_bones, model->numnorms);
-
-    qc_write (smd, "triangles");
+    trace_begin ("write", "write");
+    smd_write (smd, "triangles");
 
     for (i = 0; i < model->nummesh; ++i)
     {
-        mdl_seek (mdl, model->meshindex + sizeof (mesh) * i, SEEK_SET);
-        mdl_read (mdl, &mesh, sizeof (mesh));
-
-        /* fprintf (stdout, "Mesh %i of %s has %i triangles\n", i, model->name, mesh.numtris); */
-
-        mdl_seek (tex, textureheader->skinindex + sizeof (skin) * mesh.skinref, SEEK_SET);
-        mdl_read (tex, &skin, sizeof (skin));
-
-        mdl_seek (tex, textureheader->textureindex + sizeof (texture) * skin, SEEK_SET);
-        mdl_read (tex, &texture, sizeof (texture));
-
-        fixpath (texture.name, true);
-        stripext (texture.name);
-
-        mdl_seek (mdl, mesh.triindex, SEEK_SET);
+        /* fprintf (stdout, "Mesh %i of %s has %i triangles\n", i, model->name, meshes[i].numtris); */
 
         decomp_mesh (
             mdl,
             smd,
-            verts,
-            norms,
+            world_verts,
+            world_norms,
             vert_bones,
-            norm_bones,
             header,
-            &mesh,
-            &texture,
-            bones,
-            bone_transform);
+            meshes[i].triindex,
+            decomp_skintexture (textures, 0, meshes[i].skinref));
     }
     
-    qc_write (smd, "end");
+    smd_write (smd, "end");
+    trace_end ();
 
-    free (norm_bones);
-    free (vert_bones);
-    free (norms);
-    free (verts);
+    scratch_release (mark);
 } 
 
 void decomp_studiomodel (
-    FILE *mdl,
-    FILE *tex,
+    mdlfile_t *mdl,
+    const texturetable_t *textures,
     const char *smddir,
     studiohdr_t *header,
-    studiohdr_t *textureheader,
     mstudiomodel_t *model,
     const char *nodes)
 {
-    FILE *smd = qc_open (smddir, model->name, "smd", false);
+    trace_begin ("model", model->name);
 
-    mstudiobone_t* bones = (mstudiobone_t *)memalloc (header->numbones, sizeof (*bones));
-    mat4x3_t *bone_transform = (mat4x3_t *)memalloc (header->numbones, sizeof (*bone_transform));
+    smdfile_t *smd = smd_open (smddir, model->name);
 
-    qc_write (smd, "version 1");
-    qc_write (smd, nodes);
+    const mstudiobone_t *bones = (const mstudiobone_t *)mdl_ptr (mdl, header->boneindex, header->numbones * sizeof (*bones));
+    scratchmark_t mark = scratch_mark ();
+    mat4x3_t *bone_transform = (mat4x3_t *)scratch_alloc (header->numbones > 0 ? header->numbones : 1, sizeof (*bone_transform));
 
-    mdl_seek (mdl, header->boneindex, SEEK_SET);
-    mdl_read (mdl, bones, header->numbones * sizeof (*bones));
+    smd_write (smd, "version 1");
+    smd_write (smd, nodes);
 
     decomp_bonetransform (header, bones, bone_transform);
     
-    qc_write (smd, "skeleton");
-    decomp_writeskeleton (mdl, smd, header, bones, 0);
-    qc_write (smd, "end");
+    smd_write (smd, "skeleton");
+    decomp_writeskeleton (smd, header, bones, 0);
+    smd_write (smd, "end");
 
-    decomp_meshes (mdl, tex, smd, header, textureheader, model, bones, bone_transform);
+    decomp_meshes (mdl, textures, smd, header, model, bone_transform);
     
-    free (bone_transform);
-    free (bones);
-    fclose (smd);
+    scratch_release (mark);
+    smd_close (smd);
+
+    trace_end ();
 }
@@ -0,0 +1,255 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#include "studio.h"
+
+/*
+    Texture name filter for -pattern. A comma separated list of terms, a name
+    matches if any term does. Plain terms match anywhere in the name, and are
+    all found in one pass by an Aho-Corasick automaton. Terms with '*' or '?'
+    are globs, and must match the whole name.
+*/
+
+#define PATTERN_ALPHABET 256
+
+struct pattern_s
+{
+    int numstates;
+    int32_t *next;   /* numstates * PATTERN_ALPHABET transitions. */
+    bool *accept;    /* Some substring ends at this state. */
+    int numglobs;
+    char **globs;
+    bool matchall;   /* No terms given. */
+};
+
+static bool pattern_isglob (const char *term)
+{
+    return strpbrk (term, "*?") != NULL;
+}
+
+/* Lays the substrings out as a trie, 0 is the root and -1 a missing edge. */
+static void pattern_addterm (pattern_t *pattern, const char *term)
+{
+    int32_t state = 0;
+    const byte *c;
+
+    for (c = (const byte *)term; *c; ++c)
+    {
+        int32_t *edge = &pattern->next[state * PATTERN_ALPHABET + *c];
+
+        if (*edge < 0)
+            *edge = pattern->numstates++;
+        
+        state = *edge;
+    }
+
+    pattern->accept[state] = true;
+}
+
+/* Turns the trie into the full automaton, filling the missing edges breadth first. */
+static void pattern_build (pattern_t *pattern)
+{
+    int32_t *fail = (int32_t *)memalloc (pattern->numstates, sizeof (*fail));
+    int32_t *queue = (int32_t *)memalloc (pattern->numstates, sizeof (*queue));
+    int head = 0, tail = 0;
+    int32_t state, *edge;
+    int i;
+
+    for (i = 0; i < PATTERN_ALPHABET; ++i)
+    {
+        edge = &pattern->next[i];
+
+        if (*edge < 0)
+        {
+            *edge = 0;
+        }
+        else
+        {
+            fail[*edge] = 0;
+            queue[tail++] = *edge;
+        }
+    }
+
+    while (head < tail)
+    {
+        state = queue[head++];
+
+        if (pattern->accept[fail[state]])
+            pattern->accept[state] = true;
+
+        for (i = 0; i < PATTERN_ALPHABET; ++i)
+        {
+            edge = &pattern->next[state * PATTERN_ALPHABET + i];
+
+            if (*edge < 0)
+            {
+                *edge = pattern->next[fail[state] * PATTERN_ALPHABET + i];
+            }
+            else
+            {
+                fail[*edge] = pattern->next[fail[state] * PATTERN_ALPHABET + i];
+                queue[tail++] = *edge;
+            }
+        }
+    }
+
+    free (queue);
+    free (fail);
+}
+
+/* Names are compared the way fixpath leaves them, so the terms get the same treatment. */
+pattern_t *pattern_compile (const char *str)
+{
+    pattern_t *pattern = (pattern_t *)memalloc (1, sizeof (*pattern));
+    char *terms = strdup (str);
+    char *term, *end;
+    int maxstates = 1;
+    int numterms = 0;
+    int i;
+
+    fixpath (terms, true);
+
+    for (term = terms; term; term = end)
+    {
+        end = strchr (term, ',');
+
+        if (end)
+            *end++ = '\0';
+        
+        if (*term == '\0')
+            continue;
+        
+        if (pattern_isglob (term))
+            pattern->numglobs++;
+        else
+            maxstates += strlen (term);
+        
+        numterms++;
+    }
+
+    pattern->matchall = numterms == 0;
+    pattern->next = (int32_t *)memalloc ((size_t)maxstates * PATTERN_ALPHABET, sizeof (*pattern->next));
+    pattern->accept = (bool *)memalloc (maxstates, sizeof (*pattern->accept));
+    pattern->globs = (char **)memalloc (pattern->numglobs > 0 ? pattern->numglobs : 1, sizeof (*pattern->globs));
+    pattern->numstates = 1;
+    pattern->numglobs = 0;
+
+    for (i = 0; i < maxstates * PATTERN_ALPHABET; ++i)
+    {
+        pattern->next[i] = -1;
+    }
+
+    /* The terms are NUL separated now. */
+    for (term = terms, i = 0; i < numterms; term += strlen (term) + 1)
+    {
+        if (*term == '\0')
+            continue;
+        
+        if (pattern_isglob (term))
+            pattern->globs[pattern->numglobs++] = strdup (term);
+        else
+            pattern_addterm (pattern, term);
+        
+        i++;
+    }
+
+    pattern_build (pattern);
+
+    free (terms);
+
+    return pattern;
+}
+
+void pattern_free (pattern_t *pattern)
+{
+    int i;
+
+    if (!pattern)
+        return;
+
+    for (i = 0; i < pattern->numglobs; ++i)
+    {
+        free (pattern->globs[i]);
+    }
+
+    free (pattern->globs);
+    free (pattern->accept);
+    free (pattern->next);
+    free (pattern);
+}
+
+/* '*' is any run of characters, '?' any one, the rest is literal. */
+static bool pattern_glob (const char *glob, const char *name)
+{
+    const char *star = NULL;
+    const char *resume = NULL;
+
+    while (*name)
+    {
+        if (*glob == '*')
+        {
+            star = ++glob;
+            resume = name;
+        }
+        else if (*glob == '?' || *glob == *name)
+        {
+            glob++;
+            name++;
+        }
+        else if (star)
+        {
+            glob = star;
+            name = ++resume;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (*glob == '*')
+    {
+        glob++;
+    }
+
+    return *glob == '\0';
+}
+
+bool pattern_match (const pattern_t *pattern, const char *name)
+{
+    int32_t state = 0;
+    const byte *c;
+    int i;
+
+    if (pattern->matchall || pattern->accept[0])
+        return true;
+
+    for (c = (const byte *)name; *c; ++c)
+    {
+        state = pattern->next[state * PATTERN_ALPHABET + *c];
+
+        if (pattern->accept[state])
+            return true;
+    }
+
+    for (i = 0; i < pattern->numglobs; ++i)
+    {
+        if (pattern_glob (pattern->globs[i], name))
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,314 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include "studio.h"
+#include "thread.h"
+
+/*
+    -serve keeps one process resident, with its worker pool and caches warm,
+    and takes requests over a Unix socket. A request is the arguments of a
+    command line, one per line, ended by an empty line. The reply has a line
+    for every file written and every line of output, then the outcome:
+
+        file <path>
+        message <level> <text>
+        status <code> <description>
+
+    A connection may send any number of requests, one after another. Each
+    connection is served by a thread of its own.
+*/
+
+#ifdef _WIN32
+
+int serve_run (const char *path, servehandler_t handler)
+{
+    (void)path;
+    (void)handler;
+
+    error (DECOMP_EINVAL, "-serve isn't supported on Windows\n");
+    return DECOMP_EINVAL;
+}
+
+#else
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 /* SIGPIPE is ignored instead. */
+#endif
+
+#define SERVE_MAXARGS 256
+#define SERVE_MAXREQUEST 0x10000
+
+typedef struct
+{
+    int fd;
+    servehandler_t handler;
+    mutex_t lock; /* Replies are sent from worker threads too. */
+    bool failed;  /* The client has gone away. */
+    size_t pos;
+    size_t len;
+    char buf[4096];
+} serveconn_t;
+
+/* Removed again when the server is stopped. */
+static char serve_path[sizeof (((struct sockaddr_un *)0)->sun_path)];
+
+static void serve_stop (int sig)
+{
+    (void)sig;
+
+    unlink (serve_path);
+    _exit (0);
+}
+
+static void serve_send (serveconn_t *conn, const char *data, size_t size)
+{
+    ssize_t sent;
+
+    while (size > 0 && !conn->failed)
+    {
+        sent = send (conn->fd, data, size, MSG_NOSIGNAL);
+
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            conn->failed = true;
+            break;
+        }
+
+        data += sent;
+        size -= sent;
+    }
+}
+
+/* One reply line, prefix then text, which mustn't hold a newline. */
+static void serve_sendline (serveconn_t *conn, const char *prefix, const char *text, size_t len)
+{
+    size_t prefixlen = strlen (prefix);
+    char buf[1024];
+    char *line = buf;
+
+    if (prefixlen + len + 1 > sizeof (buf))
+        line = (char *)memalloc (prefixlen + len + 1, 1);
+
+    memcpy (line, prefix, prefixlen);
+    memcpy (line + prefixlen, text, len);
+    line[prefixlen + len] = '\n';
+
+    mutex_lock (&conn->lock);
+    serve_send (conn, line, prefixlen + len + 1);
+    mutex_unlock (&conn->lock);
+
+    if (line != buf)
+        free (line);
+}
+
+static void serve_output (void *user, const char *path)
+{
+    serve_sendline ((serveconn_t *)user, "file ", path, strlen (path));
+}
+
+static void serve_message (void *user, int level, const char *text)
+{
+    char prefix[32];
+    const char *end;
+
+    snprintf (prefix, sizeof (prefix), "message %i ", level);
+
+    /* Blank lines only space out the console. */
+    for (; *text; text = *end ? end + 1 : end)
+    {
+        end = strchr (text, '\n');
+
+        if (!end)
+            end = text + strlen (text);
+
+        if (end > text)
+            serve_sendline ((serveconn_t *)user, prefix, text, end - text);
+    }
+}
+
+/* The next byte from the client, or -1 once it's gone. */
+static int serve_getc (serveconn_t *conn)
+{
+    ssize_t got;
+
+    if (conn->pos == conn->len)
+    {
+        do
+        {
+            got = recv (conn->fd, conn->buf, sizeof (conn->buf), 0);
+        }
+        while (got < 0 && errno == EINTR);
+
+        if (got <= 0)
+            return -1;
+
+        conn->pos = 0;
+        conn->len = (size_t)got;
+    }
+
+    return (unsigned char)conn->buf[conn->pos++];
+}
+
+/*
+    Reads a request into args, one string per line, pointed to by argv after
+    a stand-in program name. Returns the argument count as main would have
+    it, 0 once the client is gone, or -1 if the request is too big.
+*/
+static int serve_readrequest (serveconn_t *conn, char *args, char **argv)
+{
+    size_t used = 0;
+    size_t start = 0;
+    int argc = 1;
+    int c;
+
+    argv[0] = "decompmdl";
+
+    while ((c = serve_getc (conn)) >= 0)
+    {
+        if (c == '\r')
+            continue;
+
+        if (used == SERVE_MAXREQUEST)
+            return -1;
+
+        if (c != '\n')
+        {
+            args[used++] = (char)c;
+            continue;
+        }
+
+        args[used++] = '\0';
+
+        if (used - 1 > start)
+        {
+            if (argc == SERVE_MAXARGS)
+                return -1;
+
+            argv[argc++] = args + start;
+        }
+        else if (argc > 1)
+        {
+            /* Empty lines before the first argument are let go. */
+            argv[argc] = NULL;
+            return argc;
+        }
+
+        start = used;
+    }
+
+    return 0;
+}
+
+static void serve_connection (void *arg)
+{
+    serveconn_t *conn = (serveconn_t *)arg;
+    char *args = (char *)memalloc (SERVE_MAXREQUEST, 1);
+    char *argv[SERVE_MAXARGS + 1];
+    decomp_report_t report = {conn, serve_output, serve_message};
+    char status[64];
+    int argc, code;
+
+    while (!conn->failed && (argc = serve_readrequest (conn, args, argv)) != 0)
+    {
+        code = argc < 0 ? DECOMP_EINVAL : conn->handler (argc, argv, &report);
+
+        snprintf (status, sizeof (status), "status %i ", code);
+        serve_sendline (conn, status, decomp_strerror (code), strlen (decomp_strerror (code)));
+
+        if (argc < 0)
+            break;
+    }
+
+    close (conn->fd);
+    mutex_destroy (&conn->lock);
+    free (conn);
+    free (args);
+
+    stats_threaddone ();
+    scratch_shutdown ();
+}
+
+/* Serves until the process is stopped. */
+int serve_run (const char *path, servehandler_t handler)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    thread_t thread;
+
+    if (strlen (path) >= sizeof (addr.sun_path))
+        error (DECOMP_EINVAL, "Socket path too long: \"%s\"\n", path);
+
+    int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0)
+        error (1, "Failed to create socket\n");
+
+    /* Left behind by a server that didn't get to clean up. */
+    if (stat (path, &st) == 0 && S_ISSOCK (st.st_mode))
+        unlink (path);
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, path);
+
+    if (bind (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0 || listen (fd, 64) < 0)
+        error (1, "Failed to listen on \"%s\"\n", path);
+
+    strcpy (serve_path, path);
+    signal (SIGPIPE, SIG_IGN);
+    signal (SIGINT, serve_stop);
+    signal (SIGTERM, serve_stop);
+
+    msg_printf ("Serving on \"%s\"...\n", path);
+
+    while (true)
+    {
+        int client = accept (fd, NULL, NULL);
+
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            unlink (path);
+            error (1, "Failed to accept a connection\n");
+        }
+
+        serveconn_t *conn = (serveconn_t *)memalloc (1, sizeof (*conn));
+        conn->fd = client;
+        conn->handler = handler;
+        mutex_init (&conn->lock);
+
+        thread_create (&thread, serve_connection, conn);
+        thread_detach (thread);
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,237 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#include "studio.h"
+
+/* Longest number smd_putfloat can produce, including the printf fallback. */
+#define SMD_MAXNUMBER 64
+
+static const uint64_t smd_pow10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000,
+};
+
+smdfile_t *smd_open (const char *filepath, const char *filename)
+{
+    smdfile_t *smd = (smdfile_t *)memalloc (1, sizeof (*smd));
+
+    smd->stream = qc_open (filepath, filename, "smd", false);
+
+    /* Everything goes through our own buffer, skip the stdio one. */
+    qc_nobuffer (smd->stream);
+
+    return smd;
+}
+
+static void smd_flush (smdfile_t *smd)
+{
+    if (smd->len == 0)
+        return;
+
+    qc_writeb (smd->stream, smd->buf, smd->len);
+    smd->len = 0;
+}
+
+void smd_close (smdfile_t *smd)
+{
+    smd_flush (smd);
+    qc_close (smd->stream);
+    free (smd);
+}
+
+static char *smd_reserve (smdfile_t *smd, size_t size)
+{
+    if (smd->len + size > sizeof (smd->buf))
+        smd_flush (smd);
+
+    return smd->buf + smd->len;
+}
+
+static char *smd_putuint (char *out, uint64_t value, int digits)
+{
+    char tmp[24];
+    int len = 0;
+
+    do
+    {
+        tmp[len++] = '0' + (char)(value % 10);
+        value /= 10;
+    }
+    while (value != 0 || len < digits);
+
+    while (len > 0)
+    {
+        *out++ = tmp[--len];
+    }
+
+    return out;
+}
+
+static char *smd_putint (char *out, int value)
+{
+    if (value < 0)
+    {
+        *out++ = '-';
+        return smd_putuint (out, -(int64_t)value, 1);
+    }
+
+    return smd_putuint (out, value, 1);
+}
+
+/*
+    Same result as printf's "%.*f" with round-half-even, without the format parsing.
+    The mantissa scaled by 10^prec fits in 44 bits, so the rounding is exact.
+*/
+static char *smd_putfloat (char *out, float value, int prec)
+{
+    uint32_t bits;
+    memcpy (&bits, &value, sizeof (bits));
+
+    int exponent = (bits >> 23) & 0xFF;
+    uint64_t mantissa = bits & 0x7FFFFF;
+
+    if (exponent == 0xFF || exponent > 150 + 19)
+    {
+        /* Inf, NaN, or too big for 64 bits. */
+        return out + snprintf (out, SMD_MAXNUMBER, "%.*f", prec, value);
+    }
+
+    if (exponent == 0)
+        exponent = 1;
+    else
+        mantissa |= 0x800000;
+
+    exponent -= 150;
+
+    uint64_t scaled = mantissa * smd_pow10[prec];
+    uint64_t result;
+
+    if (exponent >= 0)
+    {
+        result = scaled << exponent;
+    }
+    else if (exponent < -63)
+    {
+        result = 0;
+    }
+    else
+    {
+        int shift = -exponent;
+        uint64_t rem = scaled & ((1ULL << shift) - 1);
+        uint64_t half = 1ULL << (shift - 1);
+
+        result = scaled >> shift;
+
+        if (rem > half || (rem == half && (result & 1)))
+            result++;
+    }
+
+    if (bits >> 31)
+        *out++ = '-';
+
+    out = smd_putuint (out, result / smd_pow10[prec], 1);
+    *out++ = '.';
+    return smd_putuint (out, result % smd_pow10[prec], prec);
+}
+
+void smd_puts (smdfile_t *smd, const char *str)
+{
+    size_t len = strlen (str);
+
+    if (len > sizeof (smd->buf))
+    {
+        smd_flush (smd);
+        qc_writeb (smd->stream, str, len);
+        return;
+    }
+
+    memcpy (smd_reserve (smd, len), str, len);
+    smd->len += len;
+}
+
+void smd_write (smdfile_t *smd, const char *str)
+{
+    smd_puts (smd, str);
+    *smd_reserve (smd, 1) = '\n';
+    smd->len++;
+}
+
+void smd_writetime (smdfile_t *smd, int time)
+{
+    char *start = smd_reserve (smd, 32);
+    char *out = start;
+
+    memcpy (out, "  time ", 7);
+    out = smd_putint (out + 7, time);
+    *out++ = '\n';
+
+    smd->len += out - start;
+}
+
+void smd_writebone (smdfile_t *smd, int bone, const vec3_t pos, const vec3_t rot)
+{
+    char *start = smd_reserve (smd, 32 + 6 * SMD_MAXNUMBER);
+    char *out = start;
+    int i;
+
+    memcpy (out, "    ", 4);
+    out = smd_putint (out + 4, bone);
+
+    for (i = 0; i < 3; ++i)
+    {
+        *out++ = ' ';
+        out = smd_putfloat (out, pos[i], 6);
+    }
+
+    for (i = 0; i < 3; ++i)
+    {
+        *out++ = ' ';
+        out = smd_putfloat (out, rot[i], 6);
+    }
+
+    *out++ = '\n';
+
+    smd->len += out - start;
+}
+
+void smd_writevert (smdfile_t *smd, int bone, const vec3_t vert, const vec3_t norm, float s, float t)
+{
+    char *start = smd_reserve (smd, 32 + 8 * SMD_MAXNUMBER);
+    char *out = start;
+    int i;
+
+    memcpy (out, "    ", 4);
+    out = smd_putint (out + 4, bone);
+
+    for (i = 0; i < 3; ++i)
+    {
+        *out++ = ' ';
+        out = smd_putfloat (out, vert[i], 4);
+    }
+
+    for (i = 0; i < 3; ++i)
+    {
+        *out++ = ' ';
+        out = smd_putfloat (out, norm[i], 4);
+    }
+
+    *out++ = ' ';
+    out = smd_putfloat (out, s, 4);
+    *out++ = ' ';
+    out = smd_putfloat (out, t, 4);
+    *out++ = '\n';
+
+    smd->len += out - start;
+}
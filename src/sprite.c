@@ -16,7 +16,7 @@ without written permission from Valve LLC.
 
 #include "sprite.h"
 
-void decomp_writebmp (FILE *bmp, byte *data, int width, int height, byte *palette);
+void decomp_writebmp (qcfile_t *bmp, const byte *data, int width, int height, const byte *palette);
 
 static char *spr_gettype (int type)
 {
@@ -44,34 +44,39 @@ static char *spr_gettextureformat (int type)
 }
 
 void decomp_writesprframe (
-    FILE *spr,
+    mdlfile_t *spr,
     const char *bmpdir,
     const char *frame_name,
     dspriteframe_t *frame,
-    byte *palette)
+    size_t dataofs,
+    const byte *palette)
 {   
-    byte *data = (byte *)memalloc (frame->width * frame->height, 1);
-    
-    mdl_read (spr, data, frame->width * frame->height);
+    const byte *data = (const byte *)mdl_ptr (spr, dataofs, frame->width * frame->height);
+
+    trace_begin ("texture", frame_name);
 
-    FILE *bmp = qc_open (bmpdir, frame_name, "bmp", true);
+    qcfile_t *bmp = qc_open (bmpdir, frame_name, "bmp", true);
 
     decomp_writebmp (bmp, data, frame->width, frame->height, palette);
 
-    free (data);
-    fclose (bmp);
+    qc_close (bmp);
+
+    trace_end ();
 }
 
 void decomp_sprframe (
-    FILE *spr,
-    FILE *qc,
+    mdlfile_t *spr,
+    qcfile_t *qc,
     const char *cdtexture,
     const char *bmpdir,
-    byte *palette,
+    const byte *palette,
     dspriteframe_t *frame,
+    size_t dataofs,
     float interval,
     const char *frame_name)
 {
+    statsphase_t phase = stats_begin (STATS_SPRFRAMES);
+
     qc_writef (qc, "$load  %s/%s.bmp", cdtexture, frame_name);
     qc_write2f (qc, "$frame   0   0 %3i %3i", frame->width, frame->height);
 
@@ -92,7 +97,9 @@ void decomp_sprframe (
 
     qc_putc (qc, '\n');
 
-    decomp_writesprframe (spr, bmpdir, frame_name, frame, palette);
+    decomp_writesprframe (spr, bmpdir, frame_name, frame, dataofs, palette);
+
+    stats_end (phase);
 }
 
 void decomp_spr (
@@ -104,18 +111,22 @@ void decomp_spr (
 {
     int id;
     int version;
-    FILE *spr = mdl_open (sprname, &id, &version, false);
+    mdlfile_t *spr = mdl_open (sprname, &id, &version, false);
 
     if (id != IDSPRITEHEADER)
-        error (1, "Not a Valve SPR\n");
+        error (DECOMP_EFORMAT, "Not a Valve SPR\n");
     
     if (version != SPRITE_VERSION)
-        error (1, "Wrong SPR version: %i\n", version);
+        error (DECOMP_EFORMAT, "Wrong SPR version: %i\n", version);
     
-    FILE *qc = qc_open (qcdir, qcname, "qc", false);
+    qcfile_t *qc = qc_open (qcdir, qcname, "qc", false);
+
+    /* The sprite is laid out back to back, walk it with our own offset. */
+    size_t offset = 0;
 
     dsprite_t header;
-    mdl_read (spr, &header, sizeof (header));
+    mdl_readat (spr, offset, &header, sizeof (header));
+    offset += sizeof (header);
 
     qc_write (qc, "/*");
     qc_write (qc, "==============================================================================");
@@ -144,11 +155,11 @@ void decomp_spr (
     qc_putc (qc, '\n');
 
     short colors;
-    mdl_read (spr, &colors, sizeof (colors));
-
-    byte *palette = (byte *)memalloc (colors * 3, 1);
+    mdl_readat (spr, offset, &colors, sizeof (colors));
+    offset += sizeof (colors);
 
-    mdl_read (spr, palette, colors * 3);
+    const byte *palette = (const byte *)mdl_ptr (spr, offset, colors * 3);
+    offset += colors * 3;
 
     int i, j;
     dspriteframetype_t frametype;
@@ -156,16 +167,19 @@ void decomp_spr (
 
     if (header.numframes == 1)
     {
-        mdl_read (spr, &frametype, sizeof (frametype));
-        mdl_read (spr, &frame, sizeof (frame));
-        decomp_sprframe (spr, qc, cdtexture, bmpdir, palette, &frame, 0.1F, sprname);
+        offset += sizeof (frametype);
+        mdl_readat (spr, offset, &frame, sizeof (frame));
+        offset += sizeof (frame);
+        decomp_sprframe (spr, qc, cdtexture, bmpdir, palette, &frame, offset, 0.1F, sprname);
         goto sprite_done;
     }
 
     dspritegroup_t group;
     float interval_total;
-    dspriteinterval_t* intervals = memalloc (header.numframes, sizeof (dspriteinterval_t));
-    char *frame_name = (char *)memalloc (strlen (sprname) + 8, 1);
+    dspriteinterval_t *intervals;
+    scratchmark_t mark = scratch_mark ();
+    scratchmark_t groupmark;
+    char *frame_name = (char *)scratch_alloc (strlen (sprname) + 8, 1);
     int framenum = 0;
 
     /*
@@ -183,26 +197,33 @@ void decomp_spr (
     
     for (i = 0; i < header.numframes; ++i)
     {
-        mdl_read (spr, &frametype, sizeof (frametype));
+        mdl_readat (spr, offset, &frametype, sizeof (frametype));
+        offset += sizeof (frametype);
 
         if (frametype.type == SPR_SINGLE)
         {
             ++framenum;
             sprintf (frame_name, frame_format, sprname, framenum);
-            mdl_read (spr, &frame, sizeof (frame));
-            decomp_sprframe (spr, qc, cdtexture, bmpdir, palette, &frame, 0.1F, frame_name);
+            mdl_readat (spr, offset, &frame, sizeof (frame));
+            offset += sizeof (frame);
+            decomp_sprframe (spr, qc, cdtexture, bmpdir, palette, &frame, offset, 0.1F, frame_name);
+            offset += frame.width * frame.height;
             continue;
         }
 
         qc_putc (qc, '\n');
         qc_write (qc, "$groupstart");
         
-        mdl_read (spr, &group, sizeof (group));
+        mdl_readat (spr, offset, &group, sizeof (group));
+        offset += sizeof (group);
 
+        groupmark = scratch_mark ();
+        intervals = (dspriteinterval_t *)scratch_alloc (group.numframes > 0 ? group.numframes : 1, sizeof (*intervals));
         interval_total = 0.0F;
         for (j = 0; j < group.numframes; ++j)
         {
-            mdl_read (spr, intervals + j, sizeof (*intervals));
+            mdl_readat (spr, offset, intervals + j, sizeof (*intervals));
+            offset += sizeof (*intervals);
             intervals[j].interval -= interval_total;
             interval_total += intervals[j].interval;
         }
@@ -211,25 +232,26 @@ void decomp_spr (
         {
             ++framenum;
             sprintf (frame_name, frame_format, sprname, framenum);
-            mdl_read (spr, &frame, sizeof (frame));
-            decomp_sprframe (spr, qc, cdtexture, bmpdir, palette, &frame, intervals[j].interval, frame_name);
+            mdl_readat (spr, offset, &frame, sizeof (frame));
+            offset += sizeof (frame);
+            decomp_sprframe (spr, qc, cdtexture, bmpdir, palette, &frame, offset, intervals[j].interval, frame_name);
+            offset += frame.width * frame.height;
         }
 
+        scratch_release (groupmark);
+
         qc_write (qc, "$groupend");
         qc_putc (qc, '\n');
     }
 
-    free (frame_name);
-    free (intervals);
+    scratch_release (mark);
 
 sprite_done:
 
     qc_putc (qc, '\n');
 
-    free (palette);
-    
-    fclose (qc);
-    fclose (spr);
+    qc_close (qc);
+    mdl_close (spr);
 
-    fprintf (stdout, "Done!\n");
+    msg_log (MSG_NORMAL, "Done!\n");
 }
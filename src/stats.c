@@ -0,0 +1,351 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "studio.h"
+#include "thread.h"
+
+/*
+    -stats keeps times & counters per thread, nothing is shared while a run
+    is in progress. A thread's time is charged to one phase at a time, so
+    entering a phase stops the clock on the one it was in. Writes made while
+    exporting a sequence count as writes, and not as the sequence's time.
+*/
+typedef struct statsthread_s
+{
+    int64_t wall[STATS_NUMPHASES];
+    int64_t cpu[STATS_NUMPHASES];
+    int64_t counters[STATS_NUMCOUNTERS];
+    statsphase_t phase;
+    int64_t lastwall; /* When the phase was entered. */
+    int64_t lastcpu;
+    struct statsthread_s *next;
+} statsthread_t;
+
+bool stats_enabled = false;
+
+static THREADLOCAL statsthread_t *stats_self = NULL;
+
+/* Running threads, and the sums of those that finished. */
+static mutex_t stats_lock = MUTEX_INIT;
+static statsthread_t *stats_threads = NULL;
+static statsthread_t stats_done;
+static int stats_numthreads = 0;
+static int64_t stats_startwall = 0;
+
+static const char *stats_phasenames[STATS_NUMPHASES] = {
+    "other",
+    "open",
+    "header",
+    "bodygroups",
+    "sequences",
+    "textures",
+    "sprite_frames",
+    "wad_lumps",
+    "write",
+    "wait",
+    "idle",
+};
+
+static const char *stats_counternames[STATS_NUMCOUNTERS] = {
+    "inputs",
+    "input_bytes",
+    "reads",
+    "read_bytes",
+    "outputs",
+    "write_bytes",
+    "triangles",
+    "vertices",
+    "frames",
+    "bitmaps",
+};
+
+/* Nanoseconds, wall since some fixed point, and the CPU this thread used if cpu is set. */
+void stats_clock (int64_t *wall, int64_t *cpu)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    FILETIME created, exited, kernel, user;
+
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency (&freq);
+
+    QueryPerformanceCounter (&now);
+    *wall = (int64_t)(now.QuadPart / freq.QuadPart) * 1000000000 + (int64_t)(now.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+
+    if (!cpu)
+        return;
+
+    GetThreadTimes (GetCurrentThread (), &created, &exited, &kernel, &user);
+    *cpu = ((((int64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime)
+        + (((int64_t)user.dwHighDateTime << 32) | user.dwLowDateTime)) * 100;
+#else
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    *wall = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+    if (!cpu)
+        return;
+
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+    *cpu = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static statsthread_t *stats_thread (void)
+{
+    if (stats_self)
+        return stats_self;
+
+    statsthread_t *self = (statsthread_t *)memalloc (1, sizeof (*self));
+
+    self->phase = STATS_OTHER;
+    stats_clock (&self->lastwall, &self->lastcpu);
+
+    mutex_lock (&stats_lock);
+    self->next = stats_threads;
+    stats_threads = self;
+    stats_numthreads++;
+    mutex_unlock (&stats_lock);
+
+    stats_self = self;
+    return self;
+}
+
+/* Starts the clock, for the thread that will call stats_report. */
+void stats_start (void)
+{
+    stats_enabled = true;
+    stats_clock (&stats_startwall, NULL);
+    stats_thread ();
+}
+
+/* Charges the time since the last switch to the phase the thread is in. */
+static void stats_charge (statsthread_t *self)
+{
+    int64_t wall, cpu;
+
+    stats_clock (&wall, &cpu);
+
+    self->wall[self->phase] += wall - self->lastwall;
+    self->cpu[self->phase] += cpu - self->lastcpu;
+    self->lastwall = wall;
+    self->lastcpu = cpu;
+}
+
+/* Returns the phase the thread was in, for stats_end. */
+statsphase_t stats_begin (statsphase_t phase)
+{
+    if (!stats_enabled)
+        return STATS_OTHER;
+
+    statsthread_t *self = stats_thread ();
+    statsphase_t prev = self->phase;
+
+    if (phase != prev)
+    {
+        stats_charge (self);
+        self->phase = phase;
+    }
+
+    return prev;
+}
+
+void stats_end (statsphase_t prev)
+{
+    stats_begin (prev);
+}
+
+statsphase_t stats_phase (void)
+{
+    return stats_self ? stats_self->phase : STATS_OTHER;
+}
+
+void stats_add (statscounter_t counter, int64_t value)
+{
+    stats_thread ()->counters[counter] += value;
+}
+
+static void stats_sum (statsthread_t *total, const statsthread_t *from)
+{
+    int i;
+
+    for (i = 0; i < STATS_NUMPHASES; ++i)
+    {
+        total->wall[i] += from->wall[i];
+        total->cpu[i] += from->cpu[i];
+    }
+
+    for (i = 0; i < STATS_NUMCOUNTERS; ++i)
+    {
+        total->counters[i] += from->counters[i];
+    }
+}
+
+/* For threads about to exit, their numbers are kept for the report. */
+void stats_threaddone (void)
+{
+    statsthread_t *self = stats_self;
+
+    if (!self)
+        return;
+
+    stats_charge (self);
+
+    mutex_lock (&stats_lock);
+
+    statsthread_t **link = &stats_threads;
+
+    while (*link != self)
+        link = &(*link)->next;
+
+    *link = self->next;
+    stats_sum (&stats_done, self);
+
+    mutex_unlock (&stats_lock);
+
+    stats_self = NULL;
+    free (self);
+}
+
+/* Everything the threads gathered so far. */
+static void stats_total (statsthread_t *total)
+{
+    statsthread_t *thread;
+
+    memset (total, 0, sizeof (*total));
+
+    mutex_lock (&stats_lock);
+
+    stats_sum (total, &stats_done);
+
+    for (thread = stats_threads; thread; thread = thread->next)
+    {
+        stats_sum (total, thread);
+    }
+
+    mutex_unlock (&stats_lock);
+}
+
+/* For callers that only want the counters, STATS_NUMCOUNTERS of them. */
+void stats_counters (int64_t *counters)
+{
+    statsthread_t total;
+
+    stats_total (&total);
+    memcpy (counters, total.counters, sizeof (total.counters));
+}
+
+/* Stops timing & counting, what was gathered is kept. */
+void stats_stop (void)
+{
+    stats_enabled = false;
+}
+
+static double stats_seconds (int64_t ns)
+{
+    return ns / 1e9;
+}
+
+static void stats_writejson (const char *path, const statsthread_t *total, int64_t elapsed)
+{
+    FILE *file = fopen (path, "w");
+    int i;
+
+    if (!file)
+    {
+        msg_warning ("Warning: Can't write \"%s\"\n", path);
+        return;
+    }
+
+    fprintf (file, "{\n");
+    fprintf (file, "  \"elapsed\": %.6f,\n", stats_seconds (elapsed));
+    fprintf (file, "  \"threads\": %i,\n", stats_numthreads);
+    fprintf (file, "  \"phases\": {\n");
+
+    for (i = 0; i < STATS_IDLE; ++i)
+    {
+        fprintf (file, "    \"%s\": {\"wall\": %.6f, \"cpu\": %.6f}%s\n",
+            stats_phasenames[i],
+            stats_seconds (total->wall[i]),
+            stats_seconds (total->cpu[i]),
+            i < STATS_IDLE - 1 ? "," : "");
+    }
+
+    fprintf (file, "  },\n");
+    fprintf (file, "  \"counters\": {\n");
+
+    for (i = 0; i < STATS_NUMCOUNTERS; ++i)
+    {
+        fprintf (file, "    \"%s\": %" PRId64 "%s\n",
+            stats_counternames[i],
+            total->counters[i],
+            i < STATS_NUMCOUNTERS - 1 ? "," : "");
+    }
+
+    fprintf (file, "  }\n");
+    fprintf (file, "}\n");
+
+    if (fclose (file) != 0)
+        msg_warning ("Warning: Can't write \"%s\"\n", path);
+}
+
+/*
+    Prints what every thread did since stats_start, and writes it to json if
+    set. Wall & CPU are summed over the threads, worker threads' idle time is
+    left out. Other threads should be done, see stats_threaddone.
+*/
+void stats_report (const char *json)
+{
+    statsthread_t total;
+    int64_t wall, cpu, now;
+    int i;
+
+    if (!stats_enabled)
+        return;
+
+    stats_charge (stats_thread ());
+    stats_clock (&now, NULL);
+    stats_total (&total);
+
+    msg_printf ("\n%-16s%12s%12s\n", "Phase", "Wall (s)", "CPU (s)");
+
+    for (i = 0, wall = 0, cpu = 0; i < STATS_IDLE; ++i)
+    {
+        msg_printf ("%-16s%12.4f%12.4f\n", stats_phasenames[i], stats_seconds (total.wall[i]), stats_seconds (total.cpu[i]));
+        wall += total.wall[i];
+        cpu += total.cpu[i];
+    }
+
+    msg_printf ("%-16s%12.4f%12.4f\n\n", "total", stats_seconds (wall), stats_seconds (cpu));
+
+    for (i = 0; i < STATS_NUMCOUNTERS; ++i)
+    {
+        msg_printf ("%-16s%12" PRId64 "\n", stats_counternames[i], total.counters[i]);
+    }
+
+    msg_printf ("\nElapsed %.4f s, %i thread(s).\n", stats_seconds (now - stats_startwall), stats_numthreads);
+
+    if (json)
+        stats_writejson (json, &total, now - stats_startwall);
+}
@@ -15,34 +15,34 @@ without written permission from Valve LLC.
 */
 
 #include "studio.h"
+#include "thread.h"
 
 void decomp_studiomodel (
-    FILE *mdl,
-    FILE *tex,
+    mdlfile_t *mdl,
+    const texturetable_t *textures,
     const char *smddir,
     studiohdr_t *header,
-    studiohdr_t *textureheader,
     mstudiomodel_t *model,
     const char *nodes);
 
 void decomp_studiotexture (
-    FILE *tex,
+    mdlfile_t *tex,
     const char *bmpdir,
     mstudiotexture_t *texture);
 
 void decomp_studioanim (
-    FILE *seqgroup,
-    FILE *smd,
-    mstudiobone_t *bones,
+    mdlfile_t *seqgroup,
+    smdfile_t *smd,
+    const mstudiobone_t *bones,
     int numframes,
     int numbones,
     int animindex,
     const char *nodes);
 
 static void decomp_writeinfo (
-    FILE *mdl,
-    FILE *tex,
-    FILE *qc,
+    mdlfile_t *mdl,
+    mdlfile_t *tex,
+    qcfile_t *qc,
     const char *cd,
     const char *cdtexture,
     studiohdr_t *header,
@@ -73,10 +73,14 @@ static void decomp_writeinfo (
     mstudiotexture_t texture;
     bool wrote = false;
 
-    mdl_seek (tex, textureheader->textureindex, SEEK_SET);
+    const mstudiotexture_t *textures = (const mstudiotexture_t *)mdl_ptr (
+        tex,
+        textureheader->textureindex,
+        sizeof (*textures) * textureheader->numtextures);
+
     for (i = 0; i < textureheader->numtextures; ++i)
     {
-        mdl_read (tex, &texture, sizeof (texture));
+        texture = textures[i];
 
         if (!(texture.flags & ~(STUDIO_NF_CHROME | STUDIO_NF_FLATSHADE)))
             continue;
@@ -114,21 +118,22 @@ static void decomp_writeinfo (
     }
 }
 
-static char *decomp_makenodes (FILE *mdl, studiohdr_t *header)
+static char *decomp_makenodes (mdlfile_t *mdl, studiohdr_t *header)
 {
     char line[45];
-    mstudiobone_t bone;
+    const mstudiobone_t *bones = (const mstudiobone_t *)mdl_ptr (
+        mdl,
+        header->boneindex,
+        sizeof (*bones) * header->numbones);
     
-    char *str = (char *)memalloc (10 + 45 * header->numbones, 1);
+    char *str = (char *)scratch_alloc (10 + 45 * header->numbones, 1);
 
-    mdl_seek (mdl, header->boneindex, SEEK_SET);
-    strcat (str, "nodes\n");
+    strcpy (str, "nodes\n");
 
     int i;
     for (i = 0; i < header->numbones; ++i)
     {
-        mdl_read (mdl, &bone, sizeof (bone));
-        sprintf (line, "  %i \"%s\" %i\n", i, bone.name, bone.parent);
+        sprintf (line, "  %i \"%s\" %i\n", i, bones[i].name, bones[i].parent);
         strcat (str, line);
     }
 
@@ -137,38 +142,50 @@ static char *decomp_makenodes (FILE *mdl, studiohdr_t *header)
     return str;
 }
 
+/* What the outputs of a model are made from, for -incremental. */
+typedef struct
+{
+    manifest_t *manifest;
+    uint64_t model;       /* Reference SMDs, the MDL & its textures. */
+    uint64_t textures;    /* BMPs, the texture MDL. */
+    uint64_t *seqgroups;  /* Sequence SMDs, the MDL & their sequence group. */
+} modelinputs_t;
+
 static void decomp_writebodygroups (
-    FILE *mdl,
-    FILE *tex,
-    FILE *qc,
+    mdlfile_t *mdl,
+    const texturetable_t *textures,
+    qcfile_t *qc,
     const char *smddir,
     studiohdr_t *header,
-    studiohdr_t *textureheader,
-    const char *nodes)
+    const char *nodes,
+    const modelinputs_t *inputs)
 {
     int i, j;
-    mstudiobodyparts_t bodypart;
+    const mstudiobodyparts_t *bodypart;
     mstudiomodel_t model;
     bool group;
+    uint64_t hash;
+    statsphase_t phase = stats_begin (STATS_BODYGROUPS);
 
     for (i = 0; i < header->numbodyparts; ++i)
     {
-        mdl_seek (mdl, header->bodypartindex + sizeof (bodypart) * i, SEEK_SET);
-        mdl_read (mdl, &bodypart, sizeof (bodypart));
+        bodypart = (const mstudiobodyparts_t *)mdl_ptr (
+            mdl,
+            header->bodypartindex + sizeof (*bodypart) * i,
+            sizeof (*bodypart));
 
-        group = bodypart.nummodels > 1;
+        group = bodypart->nummodels > 1;
 
         if (group)
         {
-            qc_writef (qc, "$bodygroup %s", bodypart.name);
+            qc_writef (qc, "$bodygroup %s", bodypart->name);
             qc_putc (qc, '{');
             qc_putc (qc, '\n');
         }
 
-        for (j = 0; j < bodypart.nummodels; ++j)
+        for (j = 0; j < bodypart->nummodels; ++j)
         {
-            mdl_seek (mdl, bodypart.modelindex + sizeof (model) * j, SEEK_SET);
-            mdl_read (mdl, &model, sizeof(model));
+            mdl_readat (mdl, bodypart->modelindex + sizeof (model) * j, &model, sizeof (model));
 
             if (!strcasecmp (model.name, "blank") || strlen (model.name) == 0)
             {
@@ -183,7 +200,11 @@ static void decomp_writebodygroups (
                 group ? "    studio \"%s\"" : "$body studio \"%s\"",
                 model.name);
 
-            decomp_studiomodel (mdl, tex, smddir, header, textureheader, &model, nodes);
+            if (manifest_skip (inputs->manifest, smddir, model.name, "smd", inputs->model, &hash))
+                continue;
+
+            decomp_studiomodel (mdl, textures, smddir, header, &model, nodes);
+            manifest_record (inputs->manifest, smddir, model.name, "smd", inputs->model, hash);
         }
 
         if (group)
@@ -194,6 +215,8 @@ static void decomp_writebodygroups (
     }
 
     qc_putc (qc, '\n');
+
+    stats_end (phase);
 }
 
 typedef struct {
@@ -204,16 +227,14 @@ typedef struct {
 } texturegroup_t;
 
 static void decomp_writeskingroups (
-    FILE *mdl,
-    FILE *tex,
-    FILE *qc,
+    mdlfile_t *mdl,
+    qcfile_t *qc,
     studiohdr_t *header,
-    studiohdr_t *textureheader)
+    const texturetable_t *textures)
 {
-    mstudiobodyparts_t bodypart;
-    mstudiomodel_t model;
-    mstudiomesh_t mesh;
-    char texture_name[64];
+    const mstudiobodyparts_t *bodypart;
+    const mstudiomodel_t *model;
+    const mstudiomesh_t *mesh;
     int i, j, k, l;
 
     int numtexturegroups = 0;
@@ -223,38 +244,41 @@ static void decomp_writeskingroups (
     texturegroup_t *currentgroup;
     texturegroup_t *newgroup;
 
-    short *skins = (short *)memalloc (textureheader->numskinfamilies * textureheader->numskinref, sizeof (*skins));
-    short *start, *end, *cur;
+    const short *skins = textures->skins;
+    const short *start, *end, *cur;
 
-    mdl_seek (tex, textureheader->skinindex, SEEK_SET);
-    mdl_read (tex, skins, textureheader->numskinfamilies * textureheader->numskinref * sizeof (*skins));
+    bodypart = (const mstudiobodyparts_t *)mdl_ptr (
+        mdl,
+        header->bodypartindex,
+        sizeof (*bodypart) * header->numbodyparts);
 
     for (i = 0; i < header->numbodyparts; ++i)
     {
-        mdl_seek (mdl, header->bodypartindex + sizeof (bodypart) * i, SEEK_SET);
-        mdl_read (mdl, &bodypart, sizeof (bodypart));
+        model = (const mstudiomodel_t *)mdl_ptr (
+            mdl,
+            bodypart[i].modelindex,
+            sizeof (*model) * bodypart[i].nummodels);
 
-        for (j = 0; j < bodypart.nummodels; ++j)
+        for (j = 0; j < bodypart[i].nummodels; ++j)
         {
-            mdl_seek (mdl, bodypart.modelindex + sizeof (model) * j, SEEK_SET);
-            mdl_read (mdl, &model, sizeof(model));
-
-            if (!strcasecmp (model.name, "blank") || strlen (model.name) == 0)
+            if (!strcasecmp (model[j].name, "blank") || strlen (model[j].name) == 0)
                 continue;
 
-            for (k = 0; k < model.nummesh; ++k)
-            {
-                mdl_seek (mdl, model.meshindex + sizeof (mesh) * k, SEEK_SET);
-                mdl_read (mdl, &mesh, sizeof (mesh));
+            mesh = (const mstudiomesh_t *)mdl_ptr (
+                mdl,
+                model[j].meshindex,
+                sizeof (*mesh) * model[j].nummesh);
 
-                start = end = cur = skins + mesh.skinref;
+            for (k = 0; k < model[j].nummesh; ++k)
+            {
+                start = end = cur = skins + mesh[k].skinref;
 
                 texturegroup.first = 0;
                 texturegroup.length = 1;
 
-                for (l = 1; l < textureheader->numskinfamilies; ++l)
+                for (l = 1; l < textures->numskinfamilies; ++l)
                 {
-                    cur += textureheader->numskinref;
+                    cur += textures->numskinref;
 
                     if (*cur != *start)
                     {
@@ -280,7 +304,7 @@ static void decomp_writeskingroups (
                     if (texturegroup.first == currentgroup->first
                         && texturegroup.length == currentgroup->length)
                     {
-                        currentgroup->channels[mesh.skinref] = true;
+                        currentgroup->channels[mesh[k].skinref] = true;
                         foundgroup = true;
                         break;
                     }
@@ -289,9 +313,10 @@ static void decomp_writeskingroups (
 
                 if (!foundgroup)
                 {
-                    newgroup = (texturegroup_t *)memalloc (1, sizeof (*newgroup) + textureheader->numskinref);
+                    newgroup = (texturegroup_t *)scratch_alloc (1, sizeof (*newgroup) + textures->numskinref);
                     memcpy (newgroup, &texturegroup, sizeof (texturegroup));
-                    newgroup->channels[mesh.skinref] = true;
+                    memset (newgroup->channels, 0, textures->numskinref);
+                    newgroup->channels[mesh[k].skinref] = true;
                     newgroup->next = texturegroups;
                     texturegroups = newgroup;
                     numtexturegroups++;
@@ -301,7 +326,7 @@ static void decomp_writeskingroups (
     }
 
     if (numtexturegroups == 0)
-        goto skins_done;
+        return;
     
     numtexturegroups = 0;
     currentgroup = texturegroups;
@@ -313,141 +338,129 @@ static void decomp_writeskingroups (
         qc_putc (qc, '{');
         qc_putc (qc, '\n');
 
-        cur = skins + textureheader->numskinref * currentgroup->first;
-
         for (i = currentgroup->first; i < currentgroup->first + currentgroup->length; ++i)
         {
             qc_write2f (qc, "    { ");
 
-            for (j = 0; j < textureheader->numskinref; ++j)
+            for (j = 0; j < textures->numskinref; ++j)
             {
                 if (!currentgroup->channels[j])
                     continue;
 
-                mdl_seek (tex, textureheader->textureindex + sizeof (mstudiotexture_t) * cur[j], SEEK_SET);
-                mdl_read (tex, &texture_name, sizeof (texture_name));
-
-                fixpath (texture_name, true);
-                stripext (texture_name);
-
-                qc_write2f (qc, "\"%s.bmp\" ", skippath (texture_name));
+                qc_write2f (qc, "\"%s.bmp\" ", decomp_skintexture (textures, i, j)->base);
             }
             
             qc_putc (qc, '}');
             qc_putc (qc, '\n');
-
-            cur += textureheader->numskinref;
         }
 
         qc_putc (qc, '}');
         qc_putc (qc, '\n');
 
-        newgroup = currentgroup->next;
-        free (currentgroup);
-        currentgroup = newgroup;
+        currentgroup = currentgroup->next;
     }
     qc_putc (qc, '\n');
+}
 
-skins_done:
-    free (skins);
+static const char *decomp_bonename (mdlfile_t *mdl, studiohdr_t *header, int bone)
+{
+    const mstudiobone_t *ptr = (const mstudiobone_t *)mdl_ptr (
+        mdl,
+        header->boneindex + sizeof (*ptr) * bone,
+        sizeof (*ptr));
+    return ptr->name;
 }
 
-static void decomp_writeattachments (FILE *mdl, FILE *qc, studiohdr_t *header)
+static void decomp_writeattachments (mdlfile_t *mdl, qcfile_t *qc, studiohdr_t *header)
 {
     if (header->numattachments <= 0)
         return;
     
     int i;
 
-    mstudioattachment_t attachment;
-    char bone_name[32];
+    const mstudioattachment_t *attachment = (const mstudioattachment_t *)mdl_ptr (
+        mdl,
+        header->attachmentindex,
+        sizeof (*attachment) * header->numattachments);
 
     for (i = 0; i < header->numattachments; ++i)
     {
-        mdl_seek (mdl, header->attachmentindex + sizeof (attachment) * i, SEEK_SET);
-        mdl_read (mdl, &attachment, sizeof (attachment));
-
-        mdl_seek (mdl, header->boneindex + sizeof (mstudiobone_t) * attachment.bone, SEEK_SET);
-        mdl_read (mdl, bone_name, sizeof (bone_name));
-        
-        qc_writef (qc, "$attachment %i \"%s\" %g %g %g", i, bone_name, vec3_print(attachment.org));
+        qc_writef (
+            qc,
+            "$attachment %i \"%s\" %g %g %g",
+            i,
+            decomp_bonename (mdl, header, attachment[i].bone),
+            vec3_print(attachment[i].org));
     }
     
     qc_putc (qc, '\n');
 }
 
-static void decomp_writecontrollers (FILE *mdl, FILE *qc, studiohdr_t *header)
+static void decomp_writecontrollers (mdlfile_t *mdl, qcfile_t *qc, studiohdr_t *header)
 {
     if (header->numbonecontrollers <= 0)
         return;
     
     int i;
 
-    mstudiobonecontroller_t ctrl;
-    char bone_name[32];
+    const mstudiobonecontroller_t *ctrl = (const mstudiobonecontroller_t *)mdl_ptr (
+        mdl,
+        header->bonecontrollerindex,
+        sizeof (*ctrl) * header->numbonecontrollers);
 
     for (i = 0; i < header->numbonecontrollers; ++i)
     {
-        mdl_seek (mdl, header->bonecontrollerindex + sizeof (ctrl) * i, SEEK_SET);
-        mdl_read (mdl, &ctrl, sizeof (ctrl));
-
-        mdl_seek (mdl, header->boneindex + sizeof (mstudiobone_t) * ctrl.bone, SEEK_SET);
-        mdl_read (mdl, bone_name, sizeof (bone_name));
-
         qc_write2f (qc, "$controller ");
 
-        if (ctrl.index == 4)
+        if (ctrl[i].index == 4)
         {
             qc_write2f (qc, "mouth ");
         }
         else
         {
-            qc_write2f (qc, "%i ", ctrl.index);
+            qc_write2f (qc, "%i ", ctrl[i].index);
         }
 
         qc_writef (
             qc,
             "\"%s\" %s %g %g",
-            bone_name,
-            mdl_getmotionflag (ctrl.type),
-            ctrl.start,
-            ctrl.end);
+            decomp_bonename (mdl, header, ctrl[i].bone),
+            mdl_getmotionflag (ctrl[i].type),
+            ctrl[i].start,
+            ctrl[i].end);
     }
     
     qc_putc (qc, '\n');
 }
 
-static void decomp_writehitboxes (FILE *mdl, FILE *qc, studiohdr_t *header)
+static void decomp_writehitboxes (mdlfile_t *mdl, qcfile_t *qc, studiohdr_t *header)
 {
     if (header->numhitboxes <= 0)
         return;
     
     int i;
 
-    mstudiobbox_t hbox;
-    char bone_name[32];
+    const mstudiobbox_t *hbox = (const mstudiobbox_t *)mdl_ptr (
+        mdl,
+        header->hitboxindex,
+        sizeof (*hbox) * header->numhitboxes);
     bool has_hbox = false;
 
     for (i = 0; i < header->numhitboxes; ++i)
     {
-        mdl_seek (mdl, header->hitboxindex + sizeof (hbox) * i, SEEK_SET);
-        mdl_read (mdl, &hbox, sizeof (hbox));
-
         /* Toodles TODO: This skips auto generated boxes. It might not be a good idea. */
-        if (hbox.group == 0)
+        if (hbox[i].group == 0)
             continue;
         
         has_hbox = true;
 
-        mdl_seek (mdl, header->boneindex + sizeof (mstudiobone_t) * hbox.bone, SEEK_SET);
-        mdl_read (mdl, bone_name, sizeof (bone_name));
-
         qc_writef (
             qc,
             "$hbox %i \"%s\" %g %g %g  %g %g %g",
-            hbox.group, bone_name,
-            vec3_print(hbox.bbmin),
-            vec3_print(hbox.bbmax));
+            hbox[i].group,
+            decomp_bonename (mdl, header, hbox[i].bone),
+            vec3_print(hbox[i].bbmin),
+            vec3_print(hbox[i].bbmax));
     }
 
     if (has_hbox)
@@ -468,7 +481,7 @@ static bool decomp_simplesequence (mstudioseqdesc_t *seq)
         && (seq->motiontype & STUDIO_TYPES) == 0;
 }
 
-static void decomp_writeseqblends (FILE *qc, const char *cdanim, mstudioseqdesc_t *seq)
+static void decomp_writeseqblends (qcfile_t *qc, const char *cdanim, mstudioseqdesc_t *seq)
 {
     if (seq->numblends <= 1)
     {
@@ -497,12 +510,14 @@ static void decomp_writeseqblends (FILE *qc, const char *cdanim, mstudioseqdesc_
     }
 }
 
-static void decomp_writeseqact (FILE *qc, mstudioseqdesc_t *seq)
+static void decomp_writeseqact (qcfile_t *qc, mstudioseqdesc_t *seq)
 {
+    char custom[32];
+
     if (seq->activity == 0)
         return;
 
-    qc_write2f (qc, "    %s", mdl_getactname (seq->activity));
+    qc_write2f (qc, "    %s", mdl_getactname (seq->activity, custom, sizeof (custom)));
 
     if (seq->actweight != 0)
     {
@@ -512,25 +527,25 @@ static void decomp_writeseqact (FILE *qc, mstudioseqdesc_t *seq)
     qc_putc (qc, '\n');
 }
 
-static void decomp_writeseqpivots (FILE *mdl, FILE *qc, mstudioseqdesc_t *seq)
+static void decomp_writeseqpivots (mdlfile_t *mdl, qcfile_t *qc, mstudioseqdesc_t *seq)
 {
     /* Toodles: This seems to be an unfinished feature. Keeping it because StudioMDL does write it. */
     if (seq->numpivots <= 0)
         return;
 
     int i;
-    mstudiopivot_t pivot;
-    
-    mdl_seek (mdl, seq->pivotindex, SEEK_SET);
+    const mstudiopivot_t *pivot = (const mstudiopivot_t *)mdl_ptr (
+        mdl,
+        seq->pivotindex,
+        sizeof (*pivot) * seq->numpivots);
     
     for (i = 0; i < seq->numpivots; ++i)
     {
-        mdl_read (mdl, &pivot, sizeof (pivot));
-        qc_writef (qc, "    pivot %i %i %i", i, pivot.start, pivot.end);
+        qc_writef (qc, "    pivot %i %i %i", i, pivot[i].start, pivot[i].end);
     }
 }
 
-static void decomp_writeseqblendtype (FILE *qc, mstudioseqdesc_t *seq)
+static void decomp_writeseqblendtype (qcfile_t *qc, mstudioseqdesc_t *seq)
 {
     int i;
     
@@ -548,7 +563,7 @@ static void decomp_writeseqblendtype (FILE *qc, mstudioseqdesc_t *seq)
     }
 }
 
-static void decomp_writeseqnodes (FILE *qc, mstudioseqdesc_t *seq)
+static void decomp_writeseqnodes (qcfile_t *qc, mstudioseqdesc_t *seq)
 {
     if (seq->entrynode == 0
             && seq->exitnode == 0
@@ -570,7 +585,7 @@ static void decomp_writeseqnodes (FILE *qc, mstudioseqdesc_t *seq)
     }
 }
 
-static void decomp_writeseqmotiontype (FILE *qc, mstudioseqdesc_t *seq)
+static void decomp_writeseqmotiontype (qcfile_t *qc, mstudioseqdesc_t *seq)
 {
     if (!(seq->motiontype & STUDIO_TYPES))
         return;
@@ -589,31 +604,31 @@ static void decomp_writeseqmotiontype (FILE *qc, mstudioseqdesc_t *seq)
     qc_putc (qc, '\n');
 }
 
-static void decomp_writeseqevents (FILE *mdl, FILE *qc, mstudioseqdesc_t *seq)
+static void decomp_writeseqevents (mdlfile_t *mdl, qcfile_t *qc, mstudioseqdesc_t *seq)
 {
     if (seq->numevents <= 0)
         return;
     
     int i;
-    mstudioevent_t event;
-
-    mdl_seek (mdl, seq->eventindex, SEEK_SET);
+    const mstudioevent_t *event = (const mstudioevent_t *)mdl_ptr (
+        mdl,
+        seq->eventindex,
+        sizeof (*event) * seq->numevents);
     
     for (i = 0; i < seq->numevents; ++i)
     {
-        mdl_read (mdl, &event, sizeof (event));
         qc_writef (
             qc,
             "    { event %i %i \"%s\" }",
-            event.event,
-            event.frame,
-            event.options);
+            event[i].event,
+            event[i].frame,
+            event[i].options);
     }
 }
 
 static void decomp_writeseqdesc (
-    FILE *mdl,
-    FILE *qc,
+    mdlfile_t *mdl,
+    qcfile_t *qc,
     const char *cdanim,
     studiohdr_t *header,
     mstudioseqdesc_t *seq)
@@ -634,25 +649,70 @@ static void decomp_writeseqdesc (
     qc_putc (qc, '\n');
 }
 
+/* One blend of a sequence, exported on its own by the thread pool. */
+typedef struct
+{
+    mdlfile_t *seqgroup;
+    const char *animdir;
+    const mstudiobone_t *bones;
+    const char *nodes;
+    int numframes;
+    int numbones;
+    int animindex;
+    bool blend; /* One of several, for -trace. */
+    char name[sizeof (((mstudioseqdesc_t *)0)->label) + 16];
+    manifest_t *manifest;
+    uint64_t inputs;
+} animtask_t;
+
+static void decomp_writeanimation (void *arg)
+{
+    animtask_t *task = (animtask_t *)arg;
+
+    uint64_t hash;
+
+    if (manifest_skip (task->manifest, task->animdir, task->name, "smd", task->inputs, &hash))
+        return;
+
+    trace_begin (task->blend ? "blend" : "sequence", task->name);
+
+    smdfile_t *smd = smd_open (task->animdir, task->name);
+
+    decomp_studioanim (
+        task->seqgroup,
+        smd,
+        task->bones,
+        task->numframes,
+        task->numbones,
+        task->animindex,
+        task->nodes);
+
+    smd_close (smd);
+
+    trace_end ();
+
+    manifest_record (task->manifest, task->animdir, task->name, "smd", task->inputs, hash);
+}
+
+/* Set up a task for every blend of the sequence. */
 static void decomp_writeanimations (
-    FILE *mdl,
-    FILE **seqgroups,
+    mdlfile_t *mdl,
+    mdlfile_t **seqgroups,
     const char *animdir,
     studiohdr_t *header,
     const char *nodes,
     mstudioseqdesc_t *seq,
-    mstudiobone_t *bones)
+    const mstudiobone_t *bones,
+    const modelinputs_t *inputs,
+    animtask_t *tasks)
 {
-    mstudioseqgroup_t group;
-    char *animname = (char *)memalloc (strlen (seq->label) + 16, 1);
-    char blendnum[4];
-    FILE *smd;
-
-    mdl_seek (mdl, header->seqgroupindex + sizeof (group) * seq->seqgroup, SEEK_SET);
-    mdl_read (mdl, &group, sizeof (group));
+    const mstudioseqgroup_t *seqgroupdesc = (const mstudioseqgroup_t *)mdl_ptr (
+        mdl,
+        header->seqgroupindex + sizeof (*seqgroupdesc) * seq->seqgroup,
+        sizeof (*seqgroupdesc));
 
-    FILE *seqgroup = mdl;
-    int animindex = group.unused2 + seq->animindex;
+    mdlfile_t *seqgroup = mdl;
+    int animindex = seqgroupdesc->unused2 + seq->animindex;
 
     if (seq->seqgroup > 0)
     {
@@ -661,121 +721,158 @@ static void decomp_writeanimations (
     }
 
     int i;
+    animtask_t *task;
 
     for (i = 0; i < seq->numblends; ++i)
     {
-        strcpy (animname, seq->label);
+        task = &tasks[i];
+
+        strcpy (task->name, seq->label);
 
         if (seq->numblends == 2)
         {
-            strcat (animname, i == 0 ? "_down" : "_up");
+            strcat (task->name, i == 0 ? "_down" : "_up");
         }
         else if (seq->numblends > 2)
         {
-            strcat (animname, "_blend_");
-            snprintf (blendnum, 8, "%.02i", i);
-            strcat (animname, blendnum);
+            snprintf (task->name + strlen (task->name), 16, "_blend_%.02i", i);
         }
 
-        smd = qc_open (animdir, animname, "smd", false);
-
-        decomp_studioanim (
-            seqgroup,
-            smd,
-            bones,
-            seq->numframes,
-            header->numbones,
-            animindex + sizeof (mstudioanim_t) * header->numbones * i,
-            nodes);
-
-        fclose (smd);
+        task->seqgroup = seqgroup;
+        task->animdir = animdir;
+        task->bones = bones;
+        task->nodes = nodes;
+        task->numframes = seq->numframes;
+        task->numbones = header->numbones;
+        task->animindex = animindex + sizeof (mstudioanim_t) * header->numbones * i;
+        task->blend = seq->numblends > 1;
+        task->manifest = inputs->manifest;
+        task->inputs = inputs->seqgroups ? inputs->seqgroups[seq->seqgroup] : 0;
     }
-
-    free (animname);
 }
 
+/*
+    The QC lines are written in order first, then every blend of every sequence
+    is exported as a pool task. Nothing may raise an error while the tasks are
+    in flight, as they point into this frame.
+*/
 static void decomp_writesequences (
-    FILE *mdl,
-    FILE **seqgroups,
-    FILE *qc,
+    mdlfile_t *mdl,
+    mdlfile_t **seqgroups,
+    qcfile_t *qc,
     const char *smddir,
     const char *cdanim,
     studiohdr_t *header,
-    const char *nodes)
+    const char *nodes,
+    const modelinputs_t *inputs)
 {
     if (header->numseq <= 0)
         return;
     
-    int i;
+    int i, numblends = 0;
+    statsphase_t phase = stats_begin (STATS_SEQUENCES);
 
-    mstudioseqdesc_t seq;
+    mstudioseqdesc_t *seq;
+    mstudioseqdesc_t *seqs = (mstudioseqdesc_t *)scratch_alloc (header->numseq, sizeof (*seqs));
 
-    char *animdir = appenddir (smddir, cdanim);
-    mstudiobone_t *bones = (mstudiobone_t *)memalloc (header->numbones, sizeof (*bones));
+    char *animdir = scratch_appenddir (smddir, cdanim);
+    const mstudiobone_t *bones = (const mstudiobone_t *)mdl_ptr (
+        mdl,
+        header->boneindex,
+        header->numbones * sizeof (*bones));
 
-    mdl_seek (mdl, header->boneindex, SEEK_SET);
-    mdl_read (mdl, bones, header->numbones * sizeof (*bones));
+    mdl_readat (mdl, header->seqindex, seqs, sizeof (*seqs) * header->numseq);
 
     for (i = 0; i < header->numseq; ++i)
     {
-        mdl_seek (mdl, header->seqindex + sizeof(seq) * i, SEEK_SET);
-        mdl_read (mdl, &seq, sizeof(seq));
+        if (seqs[i].numblends > 0)
+            numblends += seqs[i].numblends;
+    }
 
-        qc_write2f (qc, "$sequence %s", seq.label);
+    animtask_t *tasks = (animtask_t *)scratch_alloc (numblends > 0 ? numblends : 1, sizeof (*tasks));
+    animtask_t *task = tasks;
 
-        fixpath (seq.label, true);
+    for (i = 0; i < header->numseq; ++i)
+    {
+        seq = &seqs[i];
 
-        decomp_writeanimations (mdl, seqgroups, animdir, header, nodes, &seq, bones);
+        qc_write2f (qc, "$sequence %s", seq->label);
 
-        if (!decomp_simplesequence (&seq))
+        fixpath (seq->label, true);
+
+        decomp_writeanimations (mdl, seqgroups, animdir, header, nodes, seq, bones, inputs, task);
+
+        if (seq->numblends > 0)
+            task += seq->numblends;
+
+        if (!decomp_simplesequence (seq))
         {
-            decomp_writeseqdesc (mdl, qc, cdanim, header, &seq);
+            decomp_writeseqdesc (mdl, qc, cdanim, header, seq);
             continue;
         }
 
-        qc_write2f (qc, " \"%s/%s\" fps %g", cdanim, seq.label, seq.fps);
+        qc_write2f (qc, " \"%s/%s\" fps %g", cdanim, seq->label, seq->fps);
         
-        if (seq.flags & STUDIO_LOOPING)
+        if (seq->flags & STUDIO_LOOPING)
             qc_write2f (qc, " loop");
         
         qc_putc (qc, '\n');
     }
 
-    free (animdir);
-    free (bones);
+    taskgroup_t group = {0, 0};
+
+    for (i = 0; i < numblends; ++i)
+    {
+        pool_submit (&group, decomp_writeanimation, &tasks[i]);
+    }
+
+    int code = pool_wait (&group);
+
+    stats_end (phase);
+
+    if (code != 0)
+        error (code, "Failed to write animations\n");
 }
 
 void decomp_writetextures (
-    FILE *tex,
+    mdlfile_t *tex,
     const char *smddir,
     const char *cdtexture,
-    studiohdr_t *textureheader)
+    studiohdr_t *textureheader,
+    const modelinputs_t *inputs)
 {
     int i;
     mstudiotexture_t texture;
+    uint64_t hash;
+    statsphase_t phase = stats_begin (STATS_TEXTURES);
 
-    char *bmpdir = appenddir (smddir, cdtexture);
+    char *bmpdir = scratch_appenddir (smddir, cdtexture);
 
     for (i = 0; i < textureheader->numtextures; ++i)
     {
-        mdl_seek (tex, textureheader->textureindex + sizeof (texture) * i, SEEK_SET);
-        mdl_read (tex, &texture, sizeof (texture));
+        mdl_readat (tex, textureheader->textureindex + sizeof (texture) * i, &texture, sizeof (texture));
 
         fixpath (texture.name, true);
         stripext (texture.name);
         
+        if (manifest_skip (inputs->manifest, bmpdir, skippath (texture.name), "bmp", inputs->textures, &hash))
+            continue;
+
+        trace_begin ("texture", texture.name);
         decomp_studiotexture (tex, bmpdir, &texture);
+        trace_end ();
+        manifest_record (inputs->manifest, bmpdir, skippath (texture.name), "bmp", inputs->textures, hash);
     }
 
-    free (bmpdir);
+    stats_end (phase);
 }
 
 static void decomp_loadtextures (
     const char *mdlname,
-    FILE **tex,
+    mdlfile_t **tex,
     studiohdr_t *textureheader)
 {
-    char *texname = (char *)memalloc (strlen (mdlname) + 2, 1);
+    char *texname = (char *)scratch_alloc (strlen (mdlname) + 2, 1);
     char *name, *ext;
     int id;
     int version;
@@ -790,7 +887,7 @@ static void decomp_loadtextures (
 #ifndef _WIN32
     *tex = mdl_open (texname, &id, &version, true);
     
-    if (!tex)
+    if (!*tex)
     {
         texname[strlen (mdlname) - strlen (ext)] = '\0';
         strcat (texname, "T");
@@ -802,30 +899,76 @@ static void decomp_loadtextures (
     *tex = mdl_open (texname, &id, &version, false);
 #endif
 
-    free (texname);
-
     if (id != IDSTUDIOHEADER)
-        error (1, "Not a Valve MDL\n");
+        error (DECOMP_EFORMAT, "Not a Valve MDL\n");
     
     if (version != STUDIO_VERSION)
-        error (1, "Wrong MDL version: %i\n", version);
+        error (DECOMP_EFORMAT, "Wrong MDL version: %i\n", version);
 
-    mdl_read (*tex, textureheader, sizeof (*textureheader));
+    mdl_readat (*tex, 0, textureheader, sizeof (*textureheader));
+}
+
+static void decomp_loadtexturetable (
+    mdlfile_t *tex,
+    studiohdr_t *textureheader,
+    texturetable_t *table)
+{
+    const mstudiotexture_t *textures = (const mstudiotexture_t *)mdl_ptr (
+        tex,
+        textureheader->textureindex,
+        sizeof (*textures) * textureheader->numtextures);
+    modeltexture_t *texture;
+    int i;
+
+    table->numtextures = textureheader->numtextures;
+    table->numskinref = textureheader->numskinref;
+    table->numskinfamilies = textureheader->numskinfamilies;
+    table->skins = (const short *)mdl_ptr (
+        tex,
+        textureheader->skinindex,
+        textureheader->numskinfamilies * textureheader->numskinref * sizeof (*table->skins));
+    table->textures = (modeltexture_t *)scratch_alloc (table->numtextures > 0 ? table->numtextures : 1, sizeof (*table->textures));
+
+    for (i = 0; i < table->numtextures; ++i)
+    {
+        texture = &table->textures[i];
+
+        snprintf (texture->name, sizeof (texture->name), "%.64s", textures[i].name);
+        fixpath (texture->name, true);
+        stripext (texture->name);
+
+        texture->base = skippath (texture->name);
+        texture->invwidth = 1.0F / textures[i].width;
+        texture->invheight = 1.0F / textures[i].height;
+    }
+}
+
+const modeltexture_t *decomp_skintexture (const texturetable_t *table, int family, int skinref)
+{
+    if (family < 0 || family >= table->numskinfamilies || skinref < 0 || skinref >= table->numskinref)
+        error (DECOMP_EFORMAT, "Bad skin reference: %i\n", skinref);
+    
+    int index = table->skins[family * table->numskinref + skinref];
+
+    if (index < 0 || index >= table->numtextures)
+        error (DECOMP_EFORMAT, "Bad texture index: %i\n", index);
+    
+    return &table->textures[index];
 }
 
 static void decomp_loadseqgroups (
     const char *mdlname,
-    FILE ***seqgroups,
+    mdlfile_t ***seqgroups,
     studioseqhdr_t **seqheaders,
     int numseqgroups)
 {
     int i;
-    char *seqgroupname = (char *)memalloc (strlen (mdlname) + 3, 1);
+    char *seqgroupname = (char *)scratch_alloc (strlen (mdlname) + 3, 1);
     int id;
     int version;
 
-    *seqgroups = (FILE **)memalloc (numseqgroups, sizeof (**seqgroups));
-    *seqheaders = (studioseqhdr_t *)memalloc (numseqgroups, sizeof (**seqheaders));
+    *seqgroups = (mdlfile_t **)scratch_alloc (numseqgroups, sizeof (**seqgroups));
+    *seqheaders = (studioseqhdr_t *)scratch_alloc (numseqgroups, sizeof (**seqheaders));
 
     for (i = 1; i < numseqgroups; ++i)
     {
@@ -835,15 +978,13 @@ static void decomp_loadseqgroups (
         (*seqgroups)[i] = mdl_open(seqgroupname, &id, &version, false);
         
         if (id != IDSTUDIOSEQHEADER)
-            error (1, "Not a Valve MDL sequence group\n");
+            error (DECOMP_EFORMAT, "Not a Valve MDL sequence group\n");
         
         if (version != STUDIO_VERSION)
-            error (1, "Wrong MDL version: %i\n", version);
+            error (DECOMP_EFORMAT, "Wrong MDL version: %i\n", version);
 
-        mdl_read((*seqgroups)[i], &(*seqheaders)[i], sizeof (**seqheaders));
+        mdl_readat ((*seqgroups)[i], 0, &(*seqheaders)[i], sizeof (**seqheaders));
     }
-
-    free (seqgroupname);
 }
 
 void decomp_mdl (
@@ -853,22 +994,23 @@ void decomp_mdl (
     const char *cdtexture,
     const char *cdanim,
     const char *qcdir,
-    const char *smddir)
+    const char *smddir,
+    bool incremental)
 {
     int id;
     int version;
-    FILE *mdl = mdl_open (mdlname, &id, &version, false);
+    mdlfile_t *mdl = mdl_open (mdlname, &id, &version, false);
 
     if (id != IDSTUDIOHEADER)
-        error (1, "Not a Valve MDL\n");
+        error (DECOMP_EFORMAT, "Not a Valve MDL\n");
     
     if (version != STUDIO_VERSION)
-        error (1, "Wrong MDL version: %i\n", version);
+        error (DECOMP_EFORMAT, "Wrong MDL version: %i\n", version);
     
-    FILE *qc = qc_open (qcdir, qcname, "qc", false);
+    qcfile_t *qc = qc_open (qcdir, qcname, "qc", false);
 
     studiohdr_t header;
-    mdl_read (mdl, &header, sizeof (header));
+    mdl_readat (mdl, 0, &header, sizeof (header));
 
     char modelname[65];
     strncpy (modelname, header.name, 64);
@@ -876,7 +1018,7 @@ void decomp_mdl (
     fixpath (modelname, false);
 
     /* Init the texture vars with the regular model info. */
-    FILE *tex = mdl;
+    mdlfile_t *tex = mdl;
     studiohdr_t textureheader;
     memcpy (&textureheader, &header, sizeof (textureheader));
 
@@ -886,7 +1028,7 @@ void decomp_mdl (
         decomp_loadtextures (mdlname, &tex, &textureheader);
     }
 
-    FILE **seqgroups;
+    mdlfile_t **seqgroups;
     studioseqhdr_t *seqheaders;
 
     if (header.numseqgroups > 1)
@@ -894,37 +1036,57 @@ void decomp_mdl (
         decomp_loadseqgroups (mdlname, &seqgroups, &seqheaders, header.numseqgroups);
     }
 
+    texturetable_t textures;
+    decomp_loadtexturetable (tex, &textureheader, &textures);
+
     char *nodes = decomp_makenodes (mdl, &header);
 
+    modelinputs_t inputs = {NULL, 0, 0, NULL};
+
+    if (incremental)
+    {
+        int i;
+
+        inputs.manifest = manifest_open (qcdir, qcname);
+        inputs.seqgroups = (uint64_t *)scratch_alloc (header.numseqgroups > 0 ? header.numseqgroups : 1, sizeof (*inputs.seqgroups));
+        inputs.seqgroups[0] = manifest_hashinput (mdl);
+        inputs.textures = tex == mdl ? inputs.seqgroups[0] : manifest_hashinput (tex);
+        inputs.model = hash64 (&inputs.textures, sizeof (inputs.textures), inputs.seqgroups[0]);
+
+        for (i = 1; i < header.numseqgroups; ++i)
+        {
+            inputs.seqgroups[i] = manifest_hashinput (seqgroups[i]);
+            inputs.seqgroups[i] = hash64 (&inputs.seqgroups[i], sizeof (inputs.seqgroups[i]), inputs.seqgroups[0]);
+        }
+    }
+
     decomp_writeinfo (mdl, tex, qc, cd, cdtexture, &header, &textureheader, modelname);
-    decomp_writebodygroups (mdl, tex, qc, smddir, &header, &textureheader, nodes);
-    decomp_writeskingroups (mdl, tex, qc, &header, &textureheader);
+    decomp_writebodygroups (mdl, &textures, qc, smddir, &header, nodes, &inputs);
+    decomp_writeskingroups (mdl, qc, &header, &textures);
     decomp_writeattachments (mdl, qc, &header);
     decomp_writecontrollers (mdl, qc, &header);
     decomp_writehitboxes (mdl, qc, &header);
-    decomp_writesequences (mdl, seqgroups, qc, smddir, cdanim, &header, nodes);
-    decomp_writetextures (tex, smddir, cdtexture, &textureheader);
+    decomp_writesequences (mdl, seqgroups, qc, smddir, cdanim, &header, nodes, &inputs);
+    decomp_writetextures (tex, smddir, cdtexture, &textureheader, &inputs);
 
-    free (nodes);
+    manifest_close (inputs.manifest);
 
     if (header.numseqgroups > 1)
     {
         int i;
         for (i = 1; i < header.numseqgroups; ++i)
         {
-            fclose (seqgroups[i]);
+            mdl_close (seqgroups[i]);
         }
-        free (seqheaders);
-        free (seqgroups);
     }
 
     if (header.numtextures == 0)
     {
-        fclose (tex);
+        mdl_close (tex);
     }
     
-    fclose (qc);
-    fclose (mdl);
+    qc_close (qc);
+    mdl_close (mdl);
 
-    fprintf (stdout, "Done!\n");
+    msg_log (MSG_NORMAL, "Done!\n");
 }
@@ -17,11 +17,13 @@ without written permission from Valve LLC.
 #include "studio.h"
 #include "bitmap.h"
 
-void decomp_writebmp (FILE *bmp, byte *data, int width, int height, byte *palette)
+void decomp_writebmp (qcfile_t *bmp, const byte *data, int width, int height, const byte *palette)
 {
     int real_width = ((width + 3) & ~3);
     int area = real_width * height;
 
+    STATS_COUNT (STATS_BITMAPS, 1);
+
     BITMAPFILEHEADER header;
 
     header.bfType = ('M' << 8) + 'B';
@@ -35,8 +37,6 @@ void decomp_writebmp (FILE *bmp, byte *data, int width, int height, byte *palett
     header.bfReserved1 = 0;
     header.bfReserved2 = 0;
 
-    qc_writeb (bmp, &header, sizeof (header));
-
     BITMAPINFOHEADER info;
 
     info.biSize = sizeof (BITMAPINFOHEADER);
@@ -53,8 +53,6 @@ void decomp_writebmp (FILE *bmp, byte *data, int width, int height, byte *palett
     info.biClrUsed = 256;
     info.biClrImportant = 0;
 
-    qc_writeb (bmp, &info, sizeof (info));
-
     int i;
     RGBQUAD rgba_palette[256];
 
@@ -66,37 +64,53 @@ void decomp_writebmp (FILE *bmp, byte *data, int width, int height, byte *palett
         rgba_palette[i].rgbReserved = 0;
     }
 
-    qc_writeb (bmp, rgba_palette, 256 * sizeof (RGBQUAD));
-
-    /* Reverse the order of the data. */
-
-    byte *bmp_data = (byte *)memalloc (area, 1);
-    data += (height - 1) * width;
-
-    for (i = 0; i < height; ++i)
+    /*
+        Everything goes out in one vectored write, the rows bottom up straight
+        from the source, each followed by its padding if the width needs any.
+    */
+    static const byte padding[3] = {0, 0, 0};
+    int pad = real_width - width;
+    int count = 0;
+
+    scratchmark_t mark = scratch_mark ();
+    qcvec_t *vecs = (qcvec_t *)scratch_alloc (3 + 2 * (height > 0 ? height : 0), sizeof (*vecs));
+
+    vecs[count].base = &header;
+    vecs[count++].size = sizeof (header);
+    vecs[count].base = &info;
+    vecs[count++].size = sizeof (info);
+    vecs[count].base = rgba_palette;
+    vecs[count++].size = 256 * sizeof (RGBQUAD);
+
+    for (i = height - 1; i >= 0; --i)
     {
-        memmove (&bmp_data[real_width * i], data, width);
-        data -= width;
+        vecs[count].base = data + (size_t)i * width;
+        vecs[count++].size = width;
+
+        if (pad > 0)
+        {
+            vecs[count].base = padding;
+            vecs[count++].size = pad;
+        }
     }
 
-    qc_writeb (bmp, bmp_data, area);
-    free (bmp_data);
+    trace_begin ("write", "write");
+    qc_reserve (bmp, header.bfSize);
+    qc_writev (bmp, vecs, count);
+    trace_end ();
+    scratch_release (mark);
 }
 
-void decomp_studiotexture (FILE *tex, const char *bmpdir, mstudiotexture_t *texture)
+void decomp_studiotexture (mdlfile_t *tex, const char *bmpdir, mstudiotexture_t *texture)
 {
     int area = texture->width * texture->height;
 
-    byte *data = (byte *)memalloc (area + 768, 1);
-    byte *palette = data + area;
-    
-    mdl_seek (tex, texture->index, SEEK_SET);
-    mdl_read (tex, data, area + 768);
+    const byte *data = (const byte *)mdl_ptr (tex, texture->index, area + 768);
+    const byte *palette = data + area;
 
-    FILE *bmp = qc_open (bmpdir, skippath (texture->name), "bmp", true);
+    qcfile_t *bmp = qc_open (bmpdir, skippath (texture->name), "bmp", true);
 
     decomp_writebmp (bmp, data, texture->width, texture->height, palette);
 
-    free (data);
-    fclose (bmp);
+    qc_close (bmp);
 }
@@ -0,0 +1,526 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "studio.h"
+#include "thread.h"
+
+#ifdef _WIN32
+
+void mutex_init (mutex_t *mutex)
+{
+    InitializeSRWLock ((PSRWLOCK)mutex);
+}
+
+void mutex_destroy (mutex_t *mutex)
+{
+}
+
+void mutex_lock (mutex_t *mutex)
+{
+    AcquireSRWLockExclusive ((PSRWLOCK)mutex);
+}
+
+void mutex_unlock (mutex_t *mutex)
+{
+    ReleaseSRWLockExclusive ((PSRWLOCK)mutex);
+}
+
+void cond_init (cond_t *cond)
+{
+    InitializeConditionVariable ((PCONDITION_VARIABLE)cond);
+}
+
+void cond_destroy (cond_t *cond)
+{
+}
+
+void cond_wait (cond_t *cond, mutex_t *mutex)
+{
+    SleepConditionVariableSRW ((PCONDITION_VARIABLE)cond, (PSRWLOCK)mutex, INFINITE, 0);
+}
+
+void cond_signal (cond_t *cond)
+{
+    WakeConditionVariable ((PCONDITION_VARIABLE)cond);
+}
+
+void cond_broadcast (cond_t *cond)
+{
+    WakeAllConditionVariable ((PCONDITION_VARIABLE)cond);
+}
+
+typedef struct
+{
+    void (*func) (void *);
+    void *arg;
+} threadstart_t;
+
+static DWORD WINAPI thread_start (LPVOID param)
+{
+    threadstart_t start = *(threadstart_t *)param;
+    free (param);
+    start.func (start.arg);
+    return 0;
+}
+
+void thread_create (thread_t *thread, void (*func) (void *), void *arg)
+{
+    threadstart_t *start = (threadstart_t *)memalloc (1, sizeof (*start));
+    start->func = func;
+    start->arg = arg;
+
+    *thread = CreateThread (NULL, 0, thread_start, start, 0, NULL);
+
+    if (!*thread)
+        error (1, "Failed to create thread\n");
+}
+
+void thread_join (thread_t thread)
+{
+    WaitForSingleObject ((HANDLE)thread, INFINITE);
+    CloseHandle ((HANDLE)thread);
+}
+
+void thread_detach (thread_t thread)
+{
+    CloseHandle ((HANDLE)thread);
+}
+
+int thread_numcores (void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo (&info);
+    return info.dwNumberOfProcessors;
+}
+
+int32_t atomic_add32 (volatile int32_t *ptr, int32_t val)
+{
+    return InterlockedExchangeAdd ((volatile LONG *)ptr, val) + val;
+}
+
+int32_t atomic_load32 (volatile int32_t *ptr)
+{
+    return InterlockedCompareExchange ((volatile LONG *)ptr, 0, 0);
+}
+
+bool atomic_cas32 (volatile int32_t *ptr, int32_t old, int32_t val)
+{
+    return InterlockedCompareExchange ((volatile LONG *)ptr, val, old) == old;
+}
+
+void *atomic_loadptr (void *volatile *ptr)
+{
+    return InterlockedCompareExchangePointer (ptr, NULL, NULL);
+}
+
+void *atomic_xchgptr (void *volatile *ptr, void *val)
+{
+    return InterlockedExchangePointer (ptr, val);
+}
+
+bool atomic_casptr (void *volatile *ptr, void *old, void *val)
+{
+    return InterlockedCompareExchangePointer (ptr, val, old) == old;
+}
+
+#else
+
+void mutex_init (mutex_t *mutex)
+{
+    pthread_mutex_init (mutex, NULL);
+}
+
+void mutex_destroy (mutex_t *mutex)
+{
+    pthread_mutex_destroy (mutex);
+}
+
+void mutex_lock (mutex_t *mutex)
+{
+    pthread_mutex_lock (mutex);
+}
+
+void mutex_unlock (mutex_t *mutex)
+{
+    pthread_mutex_unlock (mutex);
+}
+
+void cond_init (cond_t *cond)
+{
+    pthread_cond_init (cond, NULL);
+}
+
+void cond_destroy (cond_t *cond)
+{
+    pthread_cond_destroy (cond);
+}
+
+void cond_wait (cond_t *cond, mutex_t *mutex)
+{
+    pthread_cond_wait (cond, mutex);
+}
+
+void cond_signal (cond_t *cond)
+{
+    pthread_cond_signal (cond);
+}
+
+void cond_broadcast (cond_t *cond)
+{
+    pthread_cond_broadcast (cond);
+}
+
+typedef struct
+{
+    void (*func) (void *);
+    void *arg;
+} threadstart_t;
+
+static void *thread_start (void *param)
+{
+    threadstart_t start = *(threadstart_t *)param;
+    free (param);
+    start.func (start.arg);
+    return NULL;
+}
+
+void thread_create (thread_t *thread, void (*func) (void *), void *arg)
+{
+    threadstart_t *start = (threadstart_t *)memalloc (1, sizeof (*start));
+    start->func = func;
+    start->arg = arg;
+
+    if (pthread_create (thread, NULL, thread_start, start) != 0)
+        error (1, "Failed to create thread\n");
+}
+
+void thread_join (thread_t thread)
+{
+    pthread_join (thread, NULL);
+}
+
+void thread_detach (thread_t thread)
+{
+    pthread_detach (thread);
+}
+
+int thread_numcores (void)
+{
+    long count = sysconf (_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+int32_t atomic_add32 (volatile int32_t *ptr, int32_t val)
+{
+    return __atomic_add_fetch (ptr, val, __ATOMIC_SEQ_CST);
+}
+
+int32_t atomic_load32 (volatile int32_t *ptr)
+{
+    return __atomic_load_n (ptr, __ATOMIC_SEQ_CST);
+}
+
+bool atomic_cas32 (volatile int32_t *ptr, int32_t old, int32_t val)
+{
+    return __atomic_compare_exchange_n (ptr, &old, val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+void *atomic_loadptr (void *volatile *ptr)
+{
+    return __atomic_load_n (ptr, __ATOMIC_SEQ_CST);
+}
+
+void *atomic_xchgptr (void *volatile *ptr, void *val)
+{
+    return __atomic_exchange_n (ptr, val, __ATOMIC_SEQ_CST);
+}
+
+bool atomic_casptr (void *volatile *ptr, void *old, void *val)
+{
+    return __atomic_compare_exchange_n (ptr, &old, val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif
+
+typedef struct
+{
+    void (*func) (void *);
+    void *arg;
+    taskgroup_t *group;
+    iocontext_t *io; /* The submitter's, so a decomp_buffer call's tasks use its io. */
+    statsphase_t phase; /* Also the submitter's, for -stats. */
+} task_t;
+
+typedef struct
+{
+    mutex_t lock;
+    task_t *tasks;
+    int head; /* Oldest task, stolen by other threads. */
+    int tail; /* One past the newest task, taken by the owner. */
+    int max;
+} taskqueue_t;
+
+static int pool_size = 1;
+static taskqueue_t *pool_queues = NULL;
+static thread_t *pool_threads = NULL;
+
+static mutex_t pool_lock;
+static cond_t pool_wake;
+static volatile int32_t pool_queued = 0;
+static bool pool_quit = false;
+
+/* Queue owned by the current thread, the main thread owns the first one. */
+static THREADLOCAL int pool_index = 0;
+
+static void pool_push (taskqueue_t *queue, task_t *task)
+{
+    mutex_lock (&queue->lock);
+
+    if (queue->tail == queue->max)
+    {
+        if (queue->head > 0)
+        {
+            memmove (queue->tasks, queue->tasks + queue->head, (queue->tail - queue->head) * sizeof (*queue->tasks));
+            queue->tail -= queue->head;
+            queue->head = 0;
+        }
+        else
+        {
+            queue->max = queue->max ? queue->max * 2 : 64;
+            queue->tasks = (task_t *)realloc (queue->tasks, queue->max * sizeof (*queue->tasks));
+
+            if (!queue->tasks)
+                error (1, "Failed to allocate %i bytes\n", queue->max * sizeof (*queue->tasks));
+        }
+    }
+
+    queue->tasks[queue->tail++] = *task;
+
+    mutex_unlock (&queue->lock);
+}
+
+static bool pool_pop (taskqueue_t *queue, task_t *task, bool steal)
+{
+    bool found = false;
+
+    mutex_lock (&queue->lock);
+
+    if (queue->head < queue->tail)
+    {
+        *task = steal ? queue->tasks[queue->head++] : queue->tasks[--queue->tail];
+        found = true;
+
+        if (queue->head == queue->tail)
+            queue->head = queue->tail = 0;
+    }
+
+    mutex_unlock (&queue->lock);
+
+    return found;
+}
+
+static bool pool_trytask (task_t *task)
+{
+    int i;
+
+    if (pool_pop (&pool_queues[pool_index], task, false))
+        goto found;
+
+    for (i = 1; i < pool_size; ++i)
+    {
+        if (pool_pop (&pool_queues[(pool_index + i) % pool_size], task, true))
+            goto found;
+    }
+
+    return false;
+
+found:
+    atomic_add32 (&pool_queued, -1);
+    return true;
+}
+
+static void pool_runtask (task_t *task)
+{
+    iocontext_t *prev = io_set (task->io);
+    statsphase_t phase = stats_begin (task->phase);
+    int code = job_run (task->func, task->arg);
+
+    stats_end (phase);
+    io_set (prev);
+
+    if (code != 0)
+        atomic_cas32 (&task->group->error, 0, code);
+
+    if (atomic_add32 (&task->group->pending, -1) == 0)
+    {
+        /* Wake anyone waiting on the group. */
+        mutex_lock (&pool_lock);
+        cond_broadcast (&pool_wake);
+        mutex_unlock (&pool_lock);
+    }
+}
+
+static void pool_worker (void *arg)
+{
+    task_t task;
+    bool quit;
+
+    pool_index = (int)(intptr_t)arg;
+    stats_begin (STATS_IDLE);
+
+    while (true)
+    {
+        if (pool_trytask (&task))
+        {
+            pool_runtask (&task);
+            continue;
+        }
+
+        mutex_lock (&pool_lock);
+
+        while (!pool_quit && atomic_load32 (&pool_queued) == 0)
+            cond_wait (&pool_wake, &pool_lock);
+        
+        quit = pool_quit;
+
+        mutex_unlock (&pool_lock);
+
+        if (quit)
+            break;
+    }
+
+    stats_threaddone ();
+    scratch_shutdown ();
+}
+
+void pool_init (int numthreads)
+{
+    int i;
+
+    if (numthreads <= 1)
+        return;
+    
+    pool_size = numthreads;
+    pool_queues = (taskqueue_t *)memalloc (pool_size, sizeof (*pool_queues));
+    pool_threads = (thread_t *)memalloc (pool_size, sizeof (*pool_threads));
+
+    mutex_init (&pool_lock);
+    cond_init (&pool_wake);
+
+    for (i = 0; i < pool_size; ++i)
+    {
+        mutex_init (&pool_queues[i].lock);
+    }
+
+    for (i = 1; i < pool_size; ++i)
+    {
+        thread_create (&pool_threads[i], pool_worker, (void *)(intptr_t)i);
+    }
+}
+
+void pool_shutdown (void)
+{
+    int i;
+
+    if (pool_size <= 1)
+        return;
+    
+    mutex_lock (&pool_lock);
+    pool_quit = true;
+    cond_broadcast (&pool_wake);
+    mutex_unlock (&pool_lock);
+
+    for (i = 1; i < pool_size; ++i)
+    {
+        thread_join (pool_threads[i]);
+    }
+
+    for (i = 0; i < pool_size; ++i)
+    {
+        mutex_destroy (&pool_queues[i].lock);
+        free (pool_queues[i].tasks);
+    }
+
+    cond_destroy (&pool_wake);
+    mutex_destroy (&pool_lock);
+
+    free (pool_threads);
+    free (pool_queues);
+
+    pool_size = 1;
+    pool_queues = NULL;
+    pool_threads = NULL;
+    pool_quit = false;
+}
+
+int pool_numthreads (void)
+{
+    return pool_size;
+}
+
+void pool_submit (taskgroup_t *group, void (*func) (void *), void *arg)
+{
+    task_t task = {func, arg, group, io_get (), stats_phase ()};
+
+    atomic_add32 (&group->pending, 1);
+
+    if (pool_size <= 1)
+    {
+        /* No workers, run it right away. */
+        pool_runtask (&task);
+        return;
+    }
+
+    pool_push (&pool_queues[pool_index], &task);
+    atomic_add32 (&pool_queued, 1);
+
+    mutex_lock (&pool_lock);
+    cond_signal (&pool_wake);
+    mutex_unlock (&pool_lock);
+}
+
+int pool_wait (taskgroup_t *group)
+{
+    task_t task;
+
+    while (atomic_load32 (&group->pending) > 0)
+    {
+        if (pool_trytask (&task))
+        {
+            pool_runtask (&task);
+            continue;
+        }
+
+        statsphase_t phase = stats_begin (STATS_WAIT);
+
+        mutex_lock (&pool_lock);
+
+        while (atomic_load32 (&group->pending) > 0 && atomic_load32 (&pool_queued) == 0)
+            cond_wait (&pool_wake, &pool_lock);
+        
+        mutex_unlock (&pool_lock);
+
+        stats_end (phase);
+    }
+
+    return atomic_load32 (&group->error);
+}
@@ -0,0 +1,79 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#ifndef _THREAD_H
+#define _THREAD_H
+
+#ifdef _WIN32
+/* Kept opaque so windows.h doesn't leak into every file. */
+typedef struct { void *ptr; } mutex_t; /* SRWLOCK */
+typedef struct { void *ptr; } cond_t;  /* CONDITION_VARIABLE */
+typedef void *thread_t;                /* HANDLE */
+#define THREADLOCAL __declspec(thread)
+#define MUTEX_INIT {0}
+#else
+#include <pthread.h>
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+typedef pthread_t thread_t;
+#define THREADLOCAL __thread
+#define MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#endif
+
+/* Static mutexes may be set to MUTEX_INIT instead. */
+void mutex_init (mutex_t *mutex);
+void mutex_destroy (mutex_t *mutex);
+void mutex_lock (mutex_t *mutex);
+void mutex_unlock (mutex_t *mutex);
+
+void cond_init (cond_t *cond);
+void cond_destroy (cond_t *cond);
+void cond_wait (cond_t *cond, mutex_t *mutex);
+void cond_signal (cond_t *cond);
+void cond_broadcast (cond_t *cond);
+
+void thread_create (thread_t *thread, void (*func) (void *), void *arg);
+void thread_join (thread_t thread);
+void thread_detach (thread_t thread); /* Cleans up after itself, instead of being joined. */
+int thread_numcores (void);
+
+/* Return the new value. */
+int32_t atomic_add32 (volatile int32_t *ptr, int32_t val);
+int32_t atomic_load32 (volatile int32_t *ptr);
+bool atomic_cas32 (volatile int32_t *ptr, int32_t old, int32_t val);
+void *atomic_loadptr (void *volatile *ptr);
+void *atomic_xchgptr (void *volatile *ptr, void *val); /* Returns the old value. */
+bool atomic_casptr (void *volatile *ptr, void *old, void *val);
+
+/*
+    Work stealing thread pool. Every thread owns a queue, and takes its newest
+    task first. Idle threads steal the oldest task from the others. Waiting on
+    a group runs queued tasks instead of blocking, so tasks may submit & wait
+    on tasks of their own. Each task runs as a job, an error aborts only that task.
+*/
+typedef struct
+{
+	volatile int32_t pending;
+	volatile int32_t error; /* First error code raised by a task of the group. */
+} taskgroup_t;
+
+void pool_init (int numthreads);
+void pool_shutdown (void);
+int pool_numthreads (void);
+void pool_submit (taskgroup_t *group, void (*func) (void *), void *arg);
+int pool_wait (taskgroup_t *group);
+
+#endif /* _THREAD_H */
@@ -0,0 +1,238 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#include "studio.h"
+#include "thread.h"
+
+/*
+    -trace records spans, a file, a sequence, a texture, each thread into its
+    own list. A span is kept once it ends, as a Chrome "complete" event, and
+    the lists are written out together at the end of the run. Spans nest,
+    a thread's open ones are on a stack that job_run unwinds on errors.
+*/
+#define TRACE_MAXDEPTH 16
+
+typedef struct
+{
+    const char *cat;
+    char *name;
+    int64_t start;
+    int64_t end;
+} traceevent_t;
+
+typedef struct tracethread_s
+{
+    int tid;
+    traceevent_t *events;
+    int numevents;
+    int maxevents;
+    traceevent_t open[TRACE_MAXDEPTH];
+    int depth; /* May pass TRACE_MAXDEPTH, deeper spans aren't kept. */
+    struct tracethread_s *next;
+} tracethread_t;
+
+bool trace_enabled = false;
+
+static THREADLOCAL tracethread_t *trace_self = NULL;
+
+/* Every thread that recorded anything, kept until trace_stop. */
+static mutex_t trace_lock = MUTEX_INIT;
+static tracethread_t *trace_threads = NULL;
+static int trace_numthreads = 0;
+static int64_t trace_startwall = 0;
+static char *trace_path = NULL;
+
+static tracethread_t *trace_thread (void)
+{
+    if (trace_self)
+        return trace_self;
+
+    tracethread_t *self = (tracethread_t *)memalloc (1, sizeof (*self));
+
+    mutex_lock (&trace_lock);
+    self->tid = trace_numthreads++;
+    self->next = trace_threads;
+    trace_threads = self;
+    mutex_unlock (&trace_lock);
+
+    trace_self = self;
+    return self;
+}
+
+/* The calling thread is listed as the main one. */
+void trace_start (const char *path)
+{
+    trace_path = strdup (path);
+    trace_enabled = true;
+    stats_clock (&trace_startwall, NULL);
+    trace_thread ();
+}
+
+void trace_begin (const char *cat, const char *name)
+{
+    if (!trace_enabled)
+        return;
+
+    tracethread_t *self = trace_thread ();
+
+    if (self->depth < TRACE_MAXDEPTH)
+    {
+        traceevent_t *event = &self->open[self->depth];
+
+        event->cat = cat;
+        event->name = strdup (name);
+        stats_clock (&event->start, NULL);
+    }
+
+    self->depth++;
+}
+
+void trace_end (void)
+{
+    if (!trace_enabled)
+        return;
+
+    tracethread_t *self = trace_thread ();
+
+    if (self->depth == 0)
+        return;
+
+    if (--self->depth >= TRACE_MAXDEPTH)
+        return;
+
+    if (self->numevents == self->maxevents)
+    {
+        self->maxevents = self->maxevents ? self->maxevents * 2 : 256;
+        self->events = (traceevent_t *)realloc (self->events, self->maxevents * sizeof (*self->events));
+
+        if (!self->events)
+            error (1, "Failed to allocate %i bytes\n", self->maxevents * sizeof (*self->events));
+    }
+
+    traceevent_t *event = &self->events[self->numevents++];
+
+    *event = self->open[self->depth];
+    stats_clock (&event->end, NULL);
+}
+
+/* How many spans this thread has open, for trace_unwind. */
+int trace_depth (void)
+{
+    return trace_self ? trace_self->depth : 0;
+}
+
+/* Ends the spans opened since trace_depth returned depth, those an aborted job left open. */
+void trace_unwind (int depth)
+{
+    while (trace_depth () > depth)
+        trace_end ();
+}
+
+static void trace_writestring (FILE *file, const char *str)
+{
+    fputc ('"', file);
+
+    for (; *str; ++str)
+    {
+        if (*str == '"' || *str == '\\')
+            fprintf (file, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fprintf (file, "\\u%04x", *str);
+        else
+            fputc (*str, file);
+    }
+
+    fputc ('"', file);
+}
+
+/*
+    Writes everything recorded to the file trace_start was given, and frees
+    it. Other threads should be done by now. Times are in microseconds since
+    trace_start, as the format wants.
+*/
+void trace_stop (void)
+{
+    tracethread_t *thread, *next;
+    traceevent_t *event;
+    bool first = true;
+    int i;
+
+    if (!trace_enabled)
+        return;
+
+    trace_unwind (0);
+    trace_enabled = false;
+
+    FILE *file = fopen (trace_path, "w");
+
+    if (!file)
+        msg_warning ("Warning: Can't write \"%s\"\n", trace_path);
+
+    if (file)
+        fprintf (file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    for (thread = trace_threads; thread; thread = next)
+    {
+        next = thread->next;
+
+        if (file)
+        {
+            fprintf (file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %i, \"args\": {\"name\": ", first ? "" : ",\n", thread->tid);
+
+            if (thread->tid == 0)
+                fprintf (file, "\"main\"}}");
+            else
+                fprintf (file, "\"thread %i\"}}", thread->tid);
+
+            fprintf (file, ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": %i, \"args\": {\"sort_index\": %i}}", thread->tid, thread->tid);
+            first = false;
+        }
+
+        for (i = 0; i < thread->numevents; ++i)
+        {
+            event = &thread->events[i];
+
+            if (file)
+            {
+                fprintf (file, ",\n{\"name\": ");
+                trace_writestring (file, event->name);
+                fprintf (file, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %i}",
+                    event->cat,
+                    (event->start - trace_startwall) / 1e3,
+                    (event->end - event->start) / 1e3,
+                    thread->tid);
+            }
+
+            free (event->name);
+        }
+
+        free (thread->events);
+        free (thread);
+    }
+
+    if (file)
+    {
+        fprintf (file, "\n]}\n");
+
+        if (fclose (file) != 0)
+            msg_warning ("Warning: Can't write \"%s\"\n", trace_path);
+    }
+
+    trace_threads = NULL;
+    trace_self = NULL;
+    free (trace_path);
+    trace_path = NULL;
+}
@@ -16,146 +16,490 @@ without written permission from Valve LLC.
 
 #include "wadlib.h"
 #include "bspfile.h"
+#include "thread.h"
 
-void decomp_writebmp (FILE *bmp, byte *data, int width, int height, byte *palette);
+void decomp_writebmp (qcfile_t *bmp, const byte *data, int width, int height, const byte *palette);
 
 static void decomp_miptex (
-    FILE *wad,
+    mdlfile_t *wad,
     const char *bmpdir,
     miptex_t *mip)
 {
-    byte *data = (byte *)memalloc (mip->width * mip->height + 768, 1);
-    byte *palette = data + mip->width * mip->height;
-    
-    mdl_seek (wad, mip->offsets[0], SEEK_SET);
-    mdl_read (wad, data, mip->width * mip->height);
-
-    mdl_seek (
+    const byte *data = (const byte *)mdl_ptr (wad, mip->offsets[0], mip->width * mip->height);
+    const byte *palette = (const byte *)mdl_ptr (
         wad,
         mip->offsets[0] + (mip->width * mip->height / 64 * 85) + sizeof(unsigned short),
-        SEEK_SET
+        768
     );
-    mdl_read (wad, palette, 768);
 
-    FILE *bmp = qc_open (bmpdir, mip->name, "bmp", true);
+    trace_begin ("texture", mip->name);
+
+    qcfile_t *bmp = qc_open (bmpdir, mip->name, "bmp", true);
 
     decomp_writebmp (bmp, data, mip->width, mip->height, palette);
 
-    free (data);
-    fclose (bmp);
+    qc_close (bmp);
+
+    trace_end ();
 }
 
-void decomp_wad (
-    const char *wadname,
-    const char *bmpdir,
-    const char *pattern)
+/* Content hash of a miptex, its full size pixels and palette. */
+uint64_t decomp_miptexhash (mdlfile_t *file, uint32_t pixels, uint32_t width, uint32_t height)
 {
-    int id;
-    FILE *wad = mdl_open (wadname, &id, NULL, false);
+    size_t area = (size_t)width * height;
+    const byte *data = (const byte *)mdl_ptr (file, pixels, area);
+    const byte *palette = (const byte *)mdl_ptr (file, pixels + area / 64 * 85 + sizeof (unsigned short), 768);
 
-    if (id != IDWADHEADER)
-        error (1, "Not a Valve WAD\n");
+    return hash64 (palette, 768, hash64 (data, area, 0));
+}
 
-    wadinfo_t info;
-    mdl_read (wad, &info, sizeof (info));
+/* One texture to extract, with the console output it produced. */
+typedef struct miptask_s
+{
+    mdlfile_t *file;
+    const char *bmpdir;
+    miptex_t mip;
+    msgbuf_t msg;
+    struct miptask_s *next; /* Later texture with the same name, it runs after this one. */
+    bool chained;
+    uint32_t order;         /* Where it is in the lump directory, the last of a name wins. */
+    uint64_t hash;          /* Only set for -dedupe. */
+    char *path;
+    const char *original;   /* Earlier copy of this texture, it isn't extracted again. */
+} miptask_t;
+
+static void decomp_miptask (void *arg)
+{
+    miptask_t *task;
+    msgbuf_t *prev;
 
-    int i, j;
+    for (task = (miptask_t *)arg; task->next; task = task->next)
+        ;
 
-    lumpinfo_t lumpinfo;
-    miptex_t mip;
+    /* The last namesake is a duplicate, whatever the others write would be left in its place. */
+    if (task->original)
+        return;
 
-    if (pattern)
+    for (task = (miptask_t *)arg; task; task = task->next)
     {
-        fixpath (pattern, true);
+        prev = msg_capture (&task->msg);
+        decomp_miptex (task->file, task->bmpdir, &task->mip);
+        msg_capture (prev);
     }
+}
 
-    for (i = 0; i < info.numlumps; ++i)
+static int decomp_comparemiptask (const void *a, const void *b)
+{
+    const miptask_t *i = *(const miptask_t **)a;
+    const miptask_t *j = *(const miptask_t **)b;
+    int cmp = strcmp (i->mip.name, j->mip.name);
+
+    if (cmp != 0)
+        return cmp;
+    
+    return i->order < j->order ? -1 : (i->order > j->order);
+}
+
+/*
+    Textures sharing a name write the same BMP, so they're chained in directory
+    order and run as one task, the last one wins like it would serially.
+*/
+static void decomp_chainmiptasks (miptask_t *tasks, int count)
+{
+    scratchmark_t mark = scratch_mark ();
+    miptask_t **order = (miptask_t **)scratch_alloc (count > 0 ? count : 1, sizeof (*order));
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        order[i] = &tasks[i];
+    }
+
+    qsort (order, count, sizeof (*order), decomp_comparemiptask);
+
+    for (i = 1; i < count; ++i)
+    {
+        if (strcmp (order[i - 1]->mip.name, order[i]->mip.name))
+            continue;
+        
+        order[i - 1]->next = order[i];
+        order[i]->chained = true;
+    }
+
+    scratch_release (mark);
+}
+
+/*
+    Claimed in list order, so the first copy in a file is the one extracted.
+    Only the last of a name is claimed, the ones before it are overwritten
+    anyway, so they're neither an original nor a duplicate. Returns the
+    owner they were claimed as.
+*/
+static int32_t decomp_dedupemiptasks (miptask_t *tasks, int count)
+{
+    int32_t owner = dedupe_begin ();
+    miptask_t *task;
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        task = &tasks[i];
+
+        if (task->next)
+            continue;
+
+        task->path = qc_makename (task->bmpdir, task->mip.name, "bmp");
+        task->original = dedupe_claim (owner, task->hash, task->mip.width, task->mip.height, task->path);
+    }
+
+    return owner;
+}
+
+/*
+    Duplicates are dealt with once the originals from this file are written,
+    which is when other files get to claim them too.
+*/
+static void decomp_duplicatemiptasks (miptask_t *tasks, int count, int32_t owner, const char *filename, dedupe_t dedupe)
+{
+    qcfile_t *manifest = NULL;
+    miptask_t *task;
+    msgbuf_t *prev;
+    int i;
+
+    for (i = 0; i < count; ++i)
     {
-        mdl_seek (wad, info.infotableofs + sizeof (lumpinfo) * i, SEEK_SET);
-        mdl_read (wad, &lumpinfo, sizeof (lumpinfo));
+        task = &tasks[i];
+
+        if (task->path && !task->original)
+            dedupe_written (owner, task->hash, task->mip.width, task->mip.height);
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        task = &tasks[i];
+
+        if (!task->original)
+            continue;
+        
+        prev = msg_capture (&task->msg);
 
-        switch (lumpinfo.type)
+        if (!strcmp (task->original, task->path))
         {
-        case TYP_MIPTEX:
-            mdl_seek (wad, lumpinfo.filepos, SEEK_SET);
-            mdl_read (wad, &mip, sizeof (mip));
-            fixpath (mip.name, true);
-            
-            if (pattern && !strstr (mip.name, pattern))
-            {
-                break;
-            }
+            /* Its BMP gets written anyway. */
+        }
+        else if (dedupe == DEDUPE_LINK)
+        {
+            msg_log (MSG_NORMAL, "Linking \"%s\" to \"%s\"...\n", task->path, task->original);
 
-            for (j = 0; j < MIPLEVELS; ++j)
+            /* Not every file system has hard links, or the original may be on another. */
+            if (dedupe_link (task->original, task->path))
+                io_output (task->path);
+            else
+                decomp_miptex (task->file, task->bmpdir, &task->mip);
+        }
+        else if (dedupe == DEDUPE_MANIFEST)
+        {
+            if (!manifest)
             {
-                mip.offsets[j] += lumpinfo.filepos;
+                char *name = strdup (skippath ((char *)filename));
+                stripext (name);
+                name = (char *)realloc (name, strlen (name) + 16);
+                strcat (name, "_duplicates");
+
+                manifest = qc_open (task->bmpdir, name, "txt", false);
+                free (name);
             }
-            
-            decomp_miptex (wad, bmpdir, &mip);
-            break;
-        default:
-            break;
+
+            qc_writef (manifest, "%s\t%s", task->path, task->original);
+        }
+        else
+        {
+            msg_log (MSG_NORMAL, "Skipping \"%s\", same as \"%s\"\n", task->path, task->original);
         }
-    }
 
-    fclose (wad);
+        msg_capture (prev);
+    }
 
-    fprintf (stdout, "Done!\n");
+    if (manifest)
+        qc_close (manifest);
 }
 
-void decomp_bsptex (
-    const char *bspname,
-    const char *bmpdir,
-    const char *pattern)
+/* Extract the listed textures across the pool, printing their output in list order. */
+static void decomp_miptasks (miptask_t *tasks, int count, const char *filename, dedupe_t dedupe)
 {
-    int id;
-    FILE *bsp = mdl_open (bspname, &id, NULL, false);
+    taskgroup_t group = {0, 0};
+    int32_t owner = 0;
+    int i;
 
-    if (id != BSPVERSION)
-        fprintf (stderr, "Warning: Not a Valve BSP\n");
+    decomp_chainmiptasks (tasks, count);
 
-    dheader_t header;
-    mdl_read (bsp, &header, sizeof (header));
+    if (dedupe != DEDUPE_NONE)
+        owner = decomp_dedupemiptasks (tasks, count);
 
-    int i, j;
+    for (i = 0; i < count; ++i)
+    {
+        if (!tasks[i].chained)
+            pool_submit (&group, decomp_miptask, &tasks[i]);
+    }
 
-    int32_t nummiptex;
-    int32_t dataofs;
-    miptex_t mip;
+    int code = pool_wait (&group);
+
+    if (code == 0 && dedupe != DEDUPE_NONE)
+        decomp_duplicatemiptasks (tasks, count, owner, filename, dedupe);
+
+    for (i = 0; i < count; ++i)
+    {
+        msg_flush (&tasks[i].msg);
+        free (tasks[i].path);
+    }
+
+    if (code != 0)
+        error (code, "Failed to extract textures\n");
+}
+
+/* A lump & where it was in the directory. */
+typedef struct
+{
+    lumpinfo_t lump;
+    uint32_t order;
+} wadlump_t;
+
+static int decomp_comparelump (const void *a, const void *b)
+{
+    const wadlump_t *i = (const wadlump_t *)a;
+    const wadlump_t *j = (const wadlump_t *)b;
+
+    if (i->lump.filepos != j->lump.filepos)
+        return i->lump.filepos < j->lump.filepos ? -1 : 1;
     
-    mdl_seek (bsp, header.lumps[LUMP_TEXTURES].fileofs, SEEK_SET);
-    mdl_read (bsp, &nummiptex, sizeof (nummiptex));
+    return i->order < j->order ? -1 : (i->order > j->order);
+}
+
+/*
+    The lump directory is taken in one go, filtered down to one lump type, and
+    sorted by file position, so the lumps themselves are read front to back.
+    Each one's place in the directory goes to order if set. Returned in scratch
+    memory.
+*/
+lumpinfo_t *decomp_wadlumps (mdlfile_t *wad, int type, int *count, uint32_t **order)
+{
+    wadinfo_t info;
+    mdl_readat (wad, 0, &info, sizeof (info));
+
+    if (info.numlumps < 0)
+        error (DECOMP_EFORMAT, "Bad lump count: %i\n", info.numlumps);
+
+    const lumpinfo_t *dir = (const lumpinfo_t *)mdl_ptr (
+        wad,
+        info.infotableofs,
+        sizeof (*dir) * info.numlumps);
+    lumpinfo_t *lumps = (lumpinfo_t *)scratch_alloc (info.numlumps > 0 ? info.numlumps : 1, sizeof (*lumps));
+    uint32_t *orders = order ? (uint32_t *)scratch_alloc (info.numlumps > 0 ? info.numlumps : 1, sizeof (*orders)) : NULL;
+    scratchmark_t mark = scratch_mark ();
+    wadlump_t *sorted = (wadlump_t *)scratch_alloc (info.numlumps > 0 ? info.numlumps : 1, sizeof (*sorted));
+    int i;
 
-    if (pattern)
+    *count = 0;
+
+    for (i = 0; i < info.numlumps; ++i)
+    {
+        if (dir[i].type != type)
+            continue;
+
+        sorted[*count].lump = dir[i];
+        sorted[*count].order = i;
+        (*count)++;
+    }
+
+    qsort (sorted, *count, sizeof (*sorted), decomp_comparelump);
+
+    for (i = 0; i < *count; ++i)
     {
-        fixpath (pattern, true);
+        lumps[i] = sorted[i].lump;
+
+        if (orders)
+            orders[i] = sorted[i].order;
     }
 
+    scratch_release (mark);
+
+    if (order)
+        *order = orders;
+
+    return lumps;
+}
+
+/*
+    File offsets of every miptex in a WAD or BSP, in the order they're extracted,
+    and their places in the directory. Scratch memory.
+*/
+uint32_t *decomp_miptexofs (mdlfile_t *file, bool wad, int *count, uint32_t **order)
+{
+    uint32_t *offsets;
+    int i;
+
+    if (wad)
+    {
+        lumpinfo_t *lumps = decomp_wadlumps (file, TYP_MIPTEX, count, order);
+        offsets = (uint32_t *)scratch_alloc (*count > 0 ? *count : 1, sizeof (*offsets));
+
+        for (i = 0; i < *count; ++i)
+        {
+            offsets[i] = lumps[i].filepos;
+        }
+
+        return offsets;
+    }
+
+    dheader_t header;
+    mdl_readat (file, 0, &header, sizeof (header));
+
+    int32_t nummiptex;
+    mdl_readat (file, header.lumps[LUMP_TEXTURES].fileofs, &nummiptex, sizeof (nummiptex));
+
+    if (nummiptex < 0)
+        error (DECOMP_EFORMAT, "Bad texture count: %i\n", nummiptex);
+
+    const int32_t *dataofss = (const int32_t *)mdl_ptr (
+        file,
+        header.lumps[LUMP_TEXTURES].fileofs + sizeof (nummiptex),
+        sizeof (*dataofss) * nummiptex);
+
+    *count = nummiptex;
+    offsets = (uint32_t *)scratch_alloc (nummiptex > 0 ? nummiptex : 1, sizeof (*offsets));
+    *order = (uint32_t *)scratch_alloc (nummiptex > 0 ? nummiptex : 1, sizeof (**order));
+
     for (i = 0; i < nummiptex; ++i)
     {
-        mdl_seek (bsp, header.lumps[LUMP_TEXTURES].fileofs + sizeof (nummiptex) + sizeof (dataofs) * i, SEEK_SET);
-        mdl_read (bsp, &dataofs, sizeof (dataofs));
+        offsets[i] = dataofss[i] + header.lumps[LUMP_TEXTURES].fileofs;
+        (*order)[i] = i;
+    }
 
-        dataofs += header.lumps[LUMP_TEXTURES].fileofs;
+    return offsets;
+}
 
-        mdl_seek (bsp, dataofs, SEEK_SET);
-        mdl_read (bsp, &mip, sizeof (mip));
-        fixpath (mip.name, true);
-        
-        if (pattern && !strstr (mip.name, pattern))
+static void decomp_extractmiptex (
+    mdlfile_t *file,
+    const char *filename,
+    bool wad,
+    const char *bmpdir,
+    const pattern_t *pattern,
+    bool useindex,
+    dedupe_t dedupe)
+{
+    scratchmark_t mark = scratch_mark ();
+    statsphase_t phase = stats_begin (STATS_WADLUMPS);
+    miptask_t *tasks;
+    miptex_t mip;
+    int i, j, count = 0;
+
+    if (useindex)
+    {
+        /* Names & offsets come from the index, no miptex header is read up front. */
+        texindex_t *index = index_open (filename, file, wad);
+        const texindexentry_t *entry;
+
+        tasks = (miptask_t *)scratch_alloc (index->count > 0 ? index->count : 1, sizeof (*tasks));
+        memset (tasks, 0, (index->count > 0 ? index->count : 1) * sizeof (*tasks));
+
+        for (i = 0; i < index->count; ++i)
         {
-            continue;
+            entry = &index->entries[i];
+
+            if (pattern && !pattern_match (pattern, entry->name))
+                continue;
+            
+            memset (&mip, 0, sizeof (mip));
+            memcpy (mip.name, entry->name, sizeof (mip.name));
+            mip.width = entry->width;
+            mip.height = entry->height;
+            mip.offsets[0] = entry->pixels;
+
+            tasks[count].file = file;
+            tasks[count].bmpdir = bmpdir;
+            tasks[count].mip = mip;
+            tasks[count].order = entry->order;
+            tasks[count].hash = entry->hash;
+            count++;
         }
 
-        for (j = 0; j < MIPLEVELS; ++j)
+        index_free (index);
+    }
+    else
+    {
+        int numoffsets;
+        uint32_t *order;
+        uint32_t *offsets = decomp_miptexofs (file, wad, &numoffsets, &order);
+
+        tasks = (miptask_t *)scratch_alloc (numoffsets > 0 ? numoffsets : 1, sizeof (*tasks));
+        memset (tasks, 0, (numoffsets > 0 ? numoffsets : 1) * sizeof (*tasks));
+
+        for (i = 0; i < numoffsets; ++i)
         {
-            mip.offsets[j] += dataofs;
+            mdl_readat (file, offsets[i], &mip, sizeof (mip));
+            fixpath (mip.name, true);
+            
+            if (pattern && !pattern_match (pattern, mip.name))
+                continue;
+
+            for (j = 0; j < MIPLEVELS; ++j)
+            {
+                mip.offsets[j] += offsets[i];
+            }
+            
+            tasks[count].file = file;
+            tasks[count].bmpdir = bmpdir;
+            tasks[count].mip = mip;
+            tasks[count].order = order[i];
+
+            if (dedupe != DEDUPE_NONE)
+                tasks[count].hash = decomp_miptexhash (file, mip.offsets[0], mip.width, mip.height);
+
+            count++;
         }
-        
-        decomp_miptex (bsp, bmpdir, &mip);
     }
 
-    fclose (bsp);
+    decomp_miptasks (tasks, count, filename, dedupe);
+    scratch_release (mark);
+    stats_end (phase);
+}
+
+void decomp_wad (
+    const char *wadname,
+    const char *bmpdir,
+    const pattern_t *pattern,
+    bool useindex,
+    dedupe_t dedupe)
+{
+    int id;
+    mdlfile_t *wad = mdl_open (wadname, &id, NULL, false);
+
+    if (id != IDWADHEADER)
+        error (DECOMP_EFORMAT, "Not a Valve WAD\n");
+
+    decomp_extractmiptex (wad, wadname, true, bmpdir, pattern, useindex, dedupe);
+
+    mdl_close (wad);
+
+    msg_log (MSG_NORMAL, "Done!\n");
+}
+
+void decomp_bsptex (
+    const char *bspname,
+    const char *bmpdir,
+    const pattern_t *pattern,
+    bool useindex,
+    dedupe_t dedupe)
+{
+    int id;
+    mdlfile_t *bsp = mdl_open (bspname, &id, NULL, false);
+
+    if (id != BSPVERSION)
+        msg_warning ("Warning: Not a Valve BSP\n");
+
+    decomp_extractmiptex (bsp, bspname, false, bmpdir, pattern, useindex, dedupe);
+
+    mdl_close (bsp);
 
-    fprintf (stdout, "Done!\n");
+    msg_log (MSG_NORMAL, "Done!\n");
 }
@@ -0,0 +1,275 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "studio.h"
+#include "thread.h"
+
+/*
+    decompbench decompiles each input a number of times, through the same
+    library calls decompmdl makes, and reports its throughput. A first run
+    that isn't timed warms the caches & counts what the input holds.
+*/
+typedef struct
+{
+    int runs;
+    int numthreads;
+    bool null;       /* Through decomp_buffer, outputs are thrown away. */
+    const char *out;
+} benchoptions_t;
+
+/* A file read for -null, kept for every run of the input. */
+typedef struct benchfile_s
+{
+    char *path;
+    void *data;
+    size_t size;
+    struct benchfile_s *next;
+} benchfile_t;
+
+static benchfile_t *bench_load (benchfile_t **files, const char *path)
+{
+    benchfile_t *file;
+
+    for (file = *files; file; file = file->next)
+    {
+        if (!strcmp (file->path, path))
+            return file;
+    }
+
+    FILE *stream = fopen (path, "rb");
+
+    if (!stream)
+        return NULL;
+
+    file = (benchfile_t *)memalloc (1, sizeof (*file));
+    fseek (stream, 0, SEEK_END);
+    file->size = (size_t)ftell (stream);
+    fseek (stream, 0, SEEK_SET);
+    file->data = memalloc (file->size > 0 ? file->size : 1, 1);
+
+    if (fread (file->data, 1, file->size, stream) < file->size)
+        error (1, "Failed to read \"%s\"\n", path);
+
+    fclose (stream);
+
+    file->path = strdup (path);
+    file->next = *files;
+    *files = file;
+
+    return file;
+}
+
+static void bench_free (benchfile_t *files)
+{
+    benchfile_t *next;
+
+    for (; files; files = next)
+    {
+        next = files->next;
+        free (files->path);
+        free (files->data);
+        free (files);
+    }
+}
+
+static int bench_read (void *user, const char *path, const void **data, size_t *size)
+{
+    benchfile_t *file = bench_load ((benchfile_t **)user, path);
+
+    if (!file)
+        return 1;
+
+    *data = file->data;
+    *size = file->size;
+    return 0;
+}
+
+static void *bench_open (void *user, const char *path)
+{
+    return user;
+}
+
+static int bench_write (void *user, void *file, const void *data, size_t size)
+{
+    return 0;
+}
+
+static int bench_close (void *user, void *file, int failed)
+{
+    return 0;
+}
+
+static int bench_run (const char *path, const benchoptions_t *opts, benchfile_t **files)
+{
+    if (!opts->null)
+        return decomp_path (path, opts->out, NULL, NULL);
+
+    decomp_io_t io = {files, bench_read, bench_open, bench_write, bench_close, NULL};
+    benchfile_t *file = bench_load (files, path);
+
+    if (!file)
+        return DECOMP_EREAD;
+
+    return decomp_buffer (path, file->data, file->size, opts->out, NULL, &io);
+}
+
+/* KiB, the most this process has had resident. */
+static long bench_peakrss (void)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+
+    if (!GetProcessMemoryInfo (GetCurrentProcess (), &counters, sizeof (counters)))
+        return 0;
+
+    return (long)(counters.PeakWorkingSetSize / 1024);
+#else
+    struct rusage usage;
+
+    getrusage (RUSAGE_SELF, &usage);
+
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+static double bench_rate (int64_t count, int64_t ns)
+{
+    return ns > 0 ? count / (ns / 1e9) : 0.0;
+}
+
+/* Returns false if a run failed. */
+static bool bench_input (const char *path, const benchoptions_t *opts)
+{
+    benchfile_t *files = NULL;
+    int64_t before[STATS_NUMCOUNTERS], after[STATS_NUMCOUNTERS];
+    int64_t start, end, total = 0, best = 0;
+    int i, code;
+
+    stats_start ();
+    stats_counters (before);
+    code = bench_run (path, opts, &files);
+    stats_counters (after);
+    stats_stop ();
+
+    for (i = 0; i < opts->runs && code == DECOMP_OK; ++i)
+    {
+        stats_clock (&start, NULL);
+        code = bench_run (path, opts, &files);
+        stats_clock (&end, NULL);
+
+        total += end - start;
+
+        if (i == 0 || end - start < best)
+            best = end - start;
+    }
+
+    bench_free (files);
+
+    if (code != DECOMP_OK)
+    {
+        fprintf (stdout, "%-24s failed: %s\n", skippath ((char *)path), decomp_strerror (code));
+        return false;
+    }
+
+    int64_t mean = total / opts->runs;
+
+    fprintf (stdout, "%-24s%10.1f%10.2f%10.2f%10.1f%12.0f%12.0f%12.0f\n",
+        skippath ((char *)path),
+        (after[STATS_INPUTBYTES] - before[STATS_INPUTBYTES]) / 1024.0,
+        mean / 1e6,
+        best / 1e6,
+        bench_rate (after[STATS_INPUTBYTES] - before[STATS_INPUTBYTES], mean) / (1024 * 1024),
+        bench_rate (after[STATS_FRAMES] - before[STATS_FRAMES], mean),
+        bench_rate (after[STATS_TRIANGLES] - before[STATS_TRIANGLES], mean),
+        bench_rate (after[STATS_BITMAPS] - before[STATS_BITMAPS], mean));
+
+    return true;
+}
+
+static void bench_help (void)
+{
+    fprintf (stdout, "Usage: decompbench [options...] <input>...\n\n");
+    fprintf (stdout, "Options:\n");
+    fprintf (stdout, "\t-n <runs>\t\tTimed runs of each input, defaults to 5.\n");
+    fprintf (stdout, "\t-j <count>\t\tWorker threads, defaults to the number of CPU cores.\n");
+    fprintf (stdout, "\t-null\t\t\tDecompile from memory & throw the outputs away,\n");
+    fprintf (stdout, "\t\t\t\tinstead of writing them to disk.\n");
+    fprintf (stdout, "\t-out <directory>\tWhere outputs go, defaults to \"bench_out\".\n");
+    exit (0);
+}
+
+int main (int argc, char **argv)
+{
+    benchoptions_t opts = {5, 0, false, "bench_out"};
+    int i, numfailed = 0;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (argv[i][0] != '-')
+            break;
+
+        if (!strcmp (argv[i], "-help"))
+            bench_help ();
+        else if (!strcmp (argv[i], "-n") && i + 1 < argc)
+            opts.runs = atoi (argv[++i]);
+        else if (!strcmp (argv[i], "-j") && i + 1 < argc)
+            opts.numthreads = atoi (argv[++i]);
+        else if (!strcmp (argv[i], "-null"))
+            opts.null = true;
+        else if (!strcmp (argv[i], "-out") && i + 1 < argc)
+            opts.out = argv[++i];
+        else
+            error (1, "Unknown option: \"%s\"\n", argv[i]);
+    }
+
+    if (i >= argc)
+        bench_help ();
+
+    if (opts.runs < 1)
+        error (1, "-n must be at least 1\n");
+
+    decomp_setlevel (DECOMP_MSG_RESULT);
+    decomp_init (opts.numthreads > 0 ? opts.numthreads : 0);
+
+    fprintf (stdout, "%i run(s) of each input, %i thread(s), %s.\n\n",
+        opts.runs, pool_numthreads (), opts.null ? "outputs thrown away" : "outputs written to disk");
+
+    fprintf (stdout, "%-24s%10s%10s%10s%10s%12s%12s%12s\n",
+        "Input", "KiB", "Mean ms", "Best ms", "MiB/s", "Frames/s", "Tris/s", "Bitmaps/s");
+
+    for (; i < argc; ++i)
+    {
+        if (!bench_input (argv[i], &opts))
+            numfailed++;
+    }
+
+    decomp_shutdown ();
+
+    fprintf (stdout, "\nPeak resident memory: %li KiB\n", bench_peakrss ());
+
+    return numfailed > 0 ? 1 : 0;
+}
@@ -0,0 +1,763 @@
+/*
+===========================================================================
+Copyright (C) 1996-2002, Valve LLC. All rights reserved.
+Copyright (C) 2023 Toodles
+
+This product contains software technology licensed from Id 
+Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc. 
+All Rights Reserved.
+
+Use, distribution, and modification of this source code and/or resulting
+object code is restricted to non-commercial enhancements to products from
+Valve LLC.  All other use, distribution, or modification is prohibited
+without written permission from Valve LLC.
+===========================================================================
+*/
+
+#include "studio.h"
+#include "activity.h"
+#include "sprite.h"
+#include "wadlib.h"
+#include "bspfile.h"
+
+/*
+    decompgen writes a synthetic model, sprite, WAD & BSP for decompbench.
+    Everything comes from the seed & the sizes asked for, so the same
+    command line gives the same bytes on every machine.
+*/
+typedef struct
+{
+    uint64_t seed;
+    const char *name;
+    int bones;
+    int sequences;
+    int frames;       /* Per sequence. */
+    int models;       /* In the bodypart. */
+    int meshes;       /* Per model. */
+    int triangles;    /* Per mesh. */
+    int textures;
+    int texsize;
+    int seqgroups;
+    bool texturefile; /* Textures in a "<name>t.mdl" of their own. */
+    int sprframes;
+    int sprsize;
+    int wadtextures;
+    int wadsize;
+} genoptions_t;
+
+/* A file being put together, grown as needed. Offsets stay valid, pointers don't. */
+typedef struct
+{
+    byte *data;
+    size_t size;
+    size_t max;
+} genbuf_t;
+
+static uint64_t gen_state;
+
+/* splitmix64, the same sequence everywhere. */
+static uint64_t gen_next (void)
+{
+    uint64_t z = (gen_state += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* lo to hi, both included. */
+static int gen_int (int lo, int hi)
+{
+    return lo + (int)(gen_next () % (uint64_t)(hi - lo + 1));
+}
+
+static float gen_float (float lo, float hi)
+{
+    return lo + (hi - lo) * (float)(gen_next () >> 40) / (float)(1 << 24);
+}
+
+/* Zeroed space at the end, returns its offset. */
+static size_t gen_reserve (genbuf_t *buf, size_t size)
+{
+    size_t off = buf->size;
+
+    if (buf->size + size > buf->max)
+    {
+        buf->max = (buf->size + size) * 2;
+        buf->data = (byte *)realloc (buf->data, buf->max);
+
+        if (!buf->data)
+            error (1, "Failed to allocate %i bytes\n", buf->max);
+    }
+
+    memset (buf->data + off, 0, size);
+    buf->size += size;
+
+    return off;
+}
+
+static size_t gen_add (genbuf_t *buf, const void *data, size_t size)
+{
+    size_t off = gen_reserve (buf, size);
+
+    memcpy (buf->data + off, data, size);
+    return off;
+}
+
+static void *gen_at (genbuf_t *buf, size_t off)
+{
+    return buf->data + off;
+}
+
+static void gen_align (genbuf_t *buf, size_t n)
+{
+    if (buf->size % n)
+        gen_reserve (buf, n - buf->size % n);
+}
+
+static void gen_random (genbuf_t *buf, size_t size)
+{
+    byte *out = (byte *)gen_at (buf, gen_reserve (buf, size));
+    size_t i;
+
+    for (i = 0; i < size; ++i)
+    {
+        out[i] = (byte)gen_next ();
+    }
+}
+
+static void gen_save (genbuf_t *buf, const char *dir, const char *name, const char *suffix)
+{
+    char path[1024];
+
+    snprintf (path, sizeof (path), "%s/%s%s", dir, name, suffix);
+    qc_makepath (path);
+
+    FILE *file = fopen (path, "wb");
+
+    if (!file || fwrite (buf->data, 1, buf->size, file) < buf->size || fclose (file) != 0)
+        error (1, "Failed to write \"%s\"\n", path);
+
+    msg_printf ("%-32s%10i bytes\n", path, (int)buf->size);
+
+    free (buf->data);
+    memset (buf, 0, sizeof (*buf));
+}
+
+/*
+    One channel of a bone's animation, as runs of up to 255 frames. Each run
+    stores its first few values, the rest of the run repeats the last one.
+*/
+static void gen_channel (genbuf_t *buf, int frames)
+{
+    short value = (short)gen_int (-2000, 2000);
+    mstudioanimvalue_t run;
+    int i, total, valid;
+
+    while (frames > 0)
+    {
+        total = gen_int (1, frames < 255 ? frames : 255);
+        valid = gen_int (1, total);
+
+        run.num.valid = (byte)valid;
+        run.num.total = (byte)total;
+        gen_add (buf, &run, sizeof (run));
+
+        for (i = 0; i < valid; ++i)
+        {
+            value += (short)gen_int (-200, 200);
+            run.value = value;
+            gen_add (buf, &run, sizeof (run));
+        }
+
+        frames -= total;
+    }
+}
+
+/* Every blend's mstudioanim_t first, then their values. Returns how many channels didn't fit. */
+static int gen_anims (genbuf_t *buf, const genoptions_t *opts, int numblends, int32_t *animindex)
+{
+    int numanims = numblends * opts->bones;
+    int i, j, dropped = 0;
+
+    gen_align (buf, 4);
+    *animindex = (int32_t)gen_reserve (buf, numanims * sizeof (mstudioanim_t));
+
+    for (i = 0; i < numanims; ++i)
+    {
+        size_t anim = *animindex + i * sizeof (mstudioanim_t);
+
+        for (j = 0; j < 6; ++j)
+        {
+            /* Mostly rotations, like the real thing. */
+            if (gen_int (0, 99) >= (j < 3 ? 20 : 70))
+                continue;
+
+            /* Offsets are 16 bit, anything further away stays at rest. */
+            if (buf->size - anim > 0xFFFF)
+            {
+                dropped++;
+                continue;
+            }
+
+            ((mstudioanim_t *)gen_at (buf, anim))->offset[j] = (unsigned short)(buf->size - anim);
+            gen_channel (buf, opts->frames);
+        }
+    }
+
+    return dropped;
+}
+
+/* Strips & fans of 3 to 16 vertices, up to numtris triangles in all. */
+static int gen_tricmds (genbuf_t *buf, int numtris, int numverts, int texsize)
+{
+    short cmd[4];
+    int count, i, made = 0;
+
+    while (made < numtris)
+    {
+        count = gen_int (3, 16);
+
+        if (count - 2 > numtris - made)
+            count = numtris - made + 2;
+
+        cmd[0] = (short)(gen_int (0, 1) ? count : -count);
+        gen_add (buf, cmd, sizeof (short));
+
+        for (i = 0; i < count; ++i)
+        {
+            cmd[0] = cmd[1] = (short)gen_int (0, numverts - 1);
+            cmd[2] = (short)gen_int (0, texsize - 1);
+            cmd[3] = (short)gen_int (0, texsize - 1);
+            gen_add (buf, cmd, sizeof (cmd));
+        }
+
+        made += count - 2;
+    }
+
+    cmd[0] = 0;
+    gen_add (buf, cmd, sizeof (short));
+    gen_align (buf, 4);
+
+    return made;
+}
+
+static void gen_model (genbuf_t *buf, const genoptions_t *opts, int index, mstudiomodel_t *model)
+{
+    int numverts = opts->meshes * opts->triangles;
+    int i;
+
+    if (numverts > MAXSTUDIOVERTS)
+        numverts = MAXSTUDIOVERTS;
+
+    memset (model, 0, sizeof (*model));
+    snprintf (model->name, sizeof (model->name), "Body_%02i", index);
+    model->boundingradius = 64.0F;
+    model->numverts = model->numnorms = numverts;
+
+    /* Vertices sorted by bone, as the compiler leaves them. */
+    model->vertinfoindex = (int32_t)gen_reserve (buf, numverts);
+    for (i = 0; i < numverts; ++i)
+    {
+        buf->data[model->vertinfoindex + i] = (byte)((int64_t)i * opts->bones / numverts);
+    }
+
+    model->norminfoindex = (int32_t)gen_reserve (buf, numverts);
+    memcpy (gen_at (buf, model->norminfoindex), gen_at (buf, model->vertinfoindex), numverts);
+    gen_align (buf, 4);
+
+    model->vertindex = (int32_t)gen_reserve (buf, numverts * sizeof (vec3_t));
+    for (i = 0; i < numverts * 3; ++i)
+    {
+        ((vec_t *)gen_at (buf, model->vertindex))[i] = gen_float (-32.0F, 32.0F);
+    }
+
+    model->normindex = (int32_t)gen_reserve (buf, numverts * sizeof (vec3_t));
+    for (i = 0; i < numverts * 3; ++i)
+    {
+        ((vec_t *)gen_at (buf, model->normindex))[i] = gen_float (-1.0F, 1.0F);
+    }
+
+    mstudiomesh_t *meshes = (mstudiomesh_t *)memalloc (opts->meshes, sizeof (*meshes));
+
+    for (i = 0; i < opts->meshes; ++i)
+    {
+        meshes[i].triindex = (int32_t)buf->size;
+        meshes[i].numtris = gen_tricmds (buf, opts->triangles, numverts, opts->texsize);
+        meshes[i].skinref = i % opts->textures;
+    }
+
+    model->nummesh = opts->meshes;
+    model->meshindex = (int32_t)gen_add (buf, meshes, opts->meshes * sizeof (*meshes));
+
+    free (meshes);
+}
+
+/* Two skin families, the second with the textures rotated by one. */
+static void gen_textures (genbuf_t *buf, const genoptions_t *opts, studiohdr_t *header)
+{
+    int numtextures = opts->textures;
+    int i;
+
+    header->numtextures = numtextures;
+    header->textureindex = header->texturedataindex = (int32_t)gen_reserve (buf, numtextures * sizeof (mstudiotexture_t));
+    header->numskinref = numtextures;
+    header->numskinfamilies = 2;
+    header->skinindex = (int32_t)gen_reserve (buf, 2 * numtextures * sizeof (short));
+
+    for (i = 0; i < numtextures; ++i)
+    {
+        short *skins = (short *)gen_at (buf, header->skinindex);
+
+        skins[i] = (short)i;
+        skins[numtextures + i] = (short)((i + 1) % numtextures);
+    }
+
+    gen_align (buf, 4);
+
+    for (i = 0; i < numtextures; ++i)
+    {
+        mstudiotexture_t texture;
+
+        memset (&texture, 0, sizeof (texture));
+        snprintf (texture.name, sizeof (texture.name), "Skin_%02i.bmp", i);
+        texture.flags = i % 3 == 2 ? STUDIO_NF_MASKED : 0;
+        texture.width = opts->texsize;
+        texture.height = i % 2 ? opts->texsize / 2 : opts->texsize;
+        texture.index = (int32_t)buf->size;
+
+        gen_random (buf, texture.width * texture.height + 768);
+        memcpy (gen_at (buf, header->textureindex + i * sizeof (texture)), &texture, sizeof (texture));
+    }
+}
+
+static void gen_mdl (const genoptions_t *opts, const char *dir)
+{
+    genbuf_t mdl = {NULL, 0, 0};
+    genbuf_t tex = {NULL, 0, 0};
+    genbuf_t *groups = (genbuf_t *)memalloc (opts->seqgroups, sizeof (*groups));
+    studiohdr_t header;
+    int i, j, dropped = 0;
+
+    memset (&header, 0, sizeof (header));
+    header.id = IDSTUDIOHEADER;
+    header.version = STUDIO_VERSION;
+    snprintf (header.name, sizeof (header.name), "%s.mdl", opts->name);
+    header.max[0] = header.max[1] = header.max[2] = 32.0F;
+    header.min[0] = header.min[1] = header.min[2] = -32.0F;
+
+    gen_reserve (&mdl, sizeof (header));
+
+    /* Bones, each parented to an earlier one. */
+    header.numbones = opts->bones;
+    header.boneindex = (int32_t)gen_reserve (&mdl, opts->bones * sizeof (mstudiobone_t));
+
+    for (i = 0; i < opts->bones; ++i)
+    {
+        mstudiobone_t *bone = (mstudiobone_t *)gen_at (&mdl, header.boneindex + i * sizeof (*bone));
+
+        snprintf (bone->name, sizeof (bone->name), "Bone %02i", i);
+        bone->parent = i == 0 ? -1 : gen_int (0, i - 1);
+
+        for (j = 0; j < 6; ++j)
+        {
+            bone->bonecontroller[j] = -1;
+            bone->value[j] = j < 3 ? gen_float (-8.0F, 8.0F) : gen_float (-Q_PI, Q_PI);
+            bone->scale[j] = j < 3 ? 1.0F / 256 : 1.0F / 8192;
+        }
+    }
+
+    /* A hitbox per bone & an attachment. */
+    header.numhitboxes = opts->bones;
+    header.hitboxindex = (int32_t)gen_reserve (&mdl, opts->bones * sizeof (mstudiobbox_t));
+
+    for (i = 0; i < opts->bones; ++i)
+    {
+        mstudiobbox_t *box = (mstudiobbox_t *)gen_at (&mdl, header.hitboxindex + i * sizeof (*box));
+
+        box->bone = i;
+        box->group = i % 8;
+        for (j = 0; j < 3; ++j)
+        {
+            box->bbmin[j] = -gen_float (1.0F, 4.0F);
+            box->bbmax[j] = gen_float (1.0F, 4.0F);
+        }
+    }
+
+    mstudioattachment_t attachment;
+    memset (&attachment, 0, sizeof (attachment));
+    attachment.bone = opts->bones - 1;
+    attachment.org[2] = 8.0F;
+    header.numattachments = 1;
+    header.attachmentindex = (int32_t)gen_add (&mdl, &attachment, sizeof (attachment));
+
+    /* Sequence groups past the first are files of their own. */
+    header.numseqgroups = opts->seqgroups;
+    header.seqgroupindex = (int32_t)gen_reserve (&mdl, opts->seqgroups * sizeof (mstudioseqgroup_t));
+
+    for (i = 0; i < opts->seqgroups; ++i)
+    {
+        mstudioseqgroup_t *group = (mstudioseqgroup_t *)gen_at (&mdl, header.seqgroupindex + i * sizeof (*group));
+
+        strcpy (group->label, "default");
+
+        if (i == 0)
+            continue;
+
+        snprintf (group->name, sizeof (group->name), "models/%s%02i.mdl", opts->name, i);
+
+        studioseqhdr_t seqheader;
+        memset (&seqheader, 0, sizeof (seqheader));
+        seqheader.id = IDSTUDIOSEQHEADER;
+        seqheader.version = STUDIO_VERSION;
+        memcpy (seqheader.name, group->name, sizeof (seqheader.name));
+        gen_add (&groups[i], &seqheader, sizeof (seqheader));
+    }
+
+    header.numseq = opts->sequences;
+    header.seqindex = (int32_t)gen_reserve (&mdl, opts->sequences * sizeof (mstudioseqdesc_t));
+
+    for (i = 0; i < opts->sequences; ++i)
+    {
+        mstudioseqdesc_t seq;
+        mstudioevent_t event;
+        int group = i % opts->seqgroups;
+
+        memset (&seq, 0, sizeof (seq));
+        snprintf (seq.label, sizeof (seq.label), "seq_%03i", i);
+        seq.fps = i % 2 ? 30.0F : 15.0F;
+        seq.flags = i % 3 == 0 ? STUDIO_LOOPING : 0;
+        seq.activity = i < 8 ? ACT_IDLE + i : 0;
+        seq.actweight = seq.activity ? 1 : 0;
+        seq.numframes = opts->frames;
+        seq.motionbone = 0;
+        seq.entrynode = seq.exitnode = 1;
+        seq.seqgroup = group;
+
+        /* Every fifth is a 2 way blend, every seventh a 3 way one. */
+        seq.numblends = i % 5 == 4 ? 2 : i % 7 == 6 ? 3 : 1;
+
+        if (seq.numblends > 1)
+        {
+            seq.blendtype[0] = STUDIO_XR;
+            seq.blendstart[0] = -45.0F;
+            seq.blendend[0] = 45.0F;
+        }
+
+        seq.numevents = i % 3;
+        seq.eventindex = (int32_t)mdl.size;
+
+        for (j = 0; j < seq.numevents; ++j)
+        {
+            memset (&event, 0, sizeof (event));
+            event.frame = j * opts->frames / 2;
+            event.event = 5001 + j;
+            snprintf (event.options, sizeof (event.options), "event_%i", j);
+            gen_add (&mdl, &event, sizeof (event));
+        }
+
+        dropped += gen_anims (group == 0 ? &mdl : &groups[group], opts, seq.numblends, &seq.animindex);
+
+        memcpy (gen_at (&mdl, header.seqindex + i * sizeof (seq)), &seq, sizeof (seq));
+    }
+
+    if (dropped > 0)
+        msg_printf ("%i animation channel(s) didn't fit in 16 bit offsets, they stay at rest.\n", dropped);
+
+    /* One bodypart, a group if there are several models. */
+    mstudiobodyparts_t bodypart;
+    memset (&bodypart, 0, sizeof (bodypart));
+    strcpy (bodypart.name, "body");
+    bodypart.nummodels = opts->models;
+    bodypart.base = 1;
+    bodypart.modelindex = (int32_t)gen_reserve (&mdl, opts->models * sizeof (mstudiomodel_t));
+
+    for (i = 0; i < opts->models; ++i)
+    {
+        mstudiomodel_t model;
+
+        gen_model (&mdl, opts, i, &model);
+        memcpy (gen_at (&mdl, bodypart.modelindex + i * sizeof (model)), &model, sizeof (model));
+    }
+
+    header.numbodyparts = 1;
+    header.bodypartindex = (int32_t)gen_add (&mdl, &bodypart, sizeof (bodypart));
+
+    if (opts->texturefile)
+    {
+        studiohdr_t texheader;
+
+        memset (&texheader, 0, sizeof (texheader));
+        texheader.id = IDSTUDIOHEADER;
+        texheader.version = STUDIO_VERSION;
+        snprintf (texheader.name, sizeof (texheader.name), "%st.mdl", opts->name);
+        gen_reserve (&tex, sizeof (texheader));
+        gen_textures (&tex, opts, &texheader);
+        texheader.length = (int32_t)tex.size;
+        memcpy (gen_at (&tex, 0), &texheader, sizeof (texheader));
+        gen_save (&tex, dir, opts->name, "t.mdl");
+    }
+    else
+    {
+        gen_textures (&mdl, opts, &header);
+    }
+
+    header.length = (int32_t)mdl.size;
+    memcpy (gen_at (&mdl, 0), &header, sizeof (header));
+    gen_save (&mdl, dir, opts->name, ".mdl");
+
+    for (i = 1; i < opts->seqgroups; ++i)
+    {
+        char suffix[16];
+
+        ((studioseqhdr_t *)gen_at (&groups[i], 0))->length = (int32_t)groups[i].size;
+        snprintf (suffix, sizeof (suffix), "%02i.mdl", i);
+        gen_save (&groups[i], dir, opts->name, suffix);
+    }
+
+    free (groups);
+}
+
+static void gen_sprframe (genbuf_t *buf, int size)
+{
+    dspriteframe_t frame;
+
+    frame.width = gen_int (size / 2, size);
+    frame.height = gen_int (size / 2, size);
+    frame.origin[0] = -(frame.width >> 1);
+    frame.origin[1] = frame.height >> 1;
+
+    gen_add (buf, &frame, sizeof (frame));
+    gen_random (buf, frame.width * frame.height);
+}
+
+/* Every eighth frame is a group of two. */
+static void gen_spr (const genoptions_t *opts, const char *dir)
+{
+    genbuf_t spr = {NULL, 0, 0};
+    dsprite_t header;
+    dspriteframetype_t type;
+    dspritegroup_t group;
+    dspriteinterval_t intervals[2] = {{0.1F}, {0.25F}};
+    short colors = 256;
+    int i;
+
+    memset (&header, 0, sizeof (header));
+    header.ident = IDSPRITEHEADER;
+    header.version = SPRITE_VERSION;
+    header.type = SPR_VP_PARALLEL;
+    header.texFormat = SPR_ADDITIVE;
+    header.boundingradius = (float)opts->sprsize;
+    header.width = header.height = opts->sprsize;
+    header.numframes = opts->sprframes;
+    header.synctype = ST_RAND;
+
+    gen_add (&spr, &header, sizeof (header));
+    gen_add (&spr, &colors, sizeof (colors));
+    gen_random (&spr, 768);
+
+    for (i = 0; i < opts->sprframes; ++i)
+    {
+        type.type = i % 8 == 7 ? SPR_GROUP : SPR_SINGLE;
+        gen_add (&spr, &type, sizeof (type));
+
+        if (type.type == SPR_SINGLE)
+        {
+            gen_sprframe (&spr, opts->sprsize);
+            continue;
+        }
+
+        group.numframes = 2;
+        gen_add (&spr, &group, sizeof (group));
+        gen_add (&spr, intervals, sizeof (intervals));
+        gen_sprframe (&spr, opts->sprsize);
+        gen_sprframe (&spr, opts->sprsize);
+    }
+
+    gen_save (&spr, dir, opts->name, ".spr");
+}
+
+/* A miptex with its four mip levels & palette, returns its offset. */
+static size_t gen_miptex (genbuf_t *buf, int index, int size)
+{
+    miptex_t mip;
+    size_t area;
+    short colors = 256;
+
+    memset (&mip, 0, sizeof (mip));
+    snprintf (mip.name, sizeof (mip.name), index % 5 == 4 ? "{fence_%03i" : "tex_%03i", index);
+    mip.width = size;
+    mip.height = index % 2 ? size / 2 : size;
+
+    area = (size_t)mip.width * mip.height;
+    mip.offsets[0] = sizeof (mip);
+    mip.offsets[1] = (uint32_t)(mip.offsets[0] + area);
+    mip.offsets[2] = (uint32_t)(mip.offsets[1] + area / 4);
+    mip.offsets[3] = (uint32_t)(mip.offsets[2] + area / 16);
+
+    size_t off = gen_add (buf, &mip, sizeof (mip));
+    gen_random (buf, area / 64 * 85);
+    gen_add (buf, &colors, sizeof (colors));
+    gen_random (buf, 768);
+    gen_align (buf, 4);
+
+    return off;
+}
+
+static void gen_wad (const genoptions_t *opts, const char *dir)
+{
+    genbuf_t wad = {NULL, 0, 0};
+    wadinfo_t header;
+    lumpinfo_t *lumps = (lumpinfo_t *)memalloc (opts->wadtextures, sizeof (*lumps));
+    int i;
+
+    gen_reserve (&wad, sizeof (header));
+
+    for (i = 0; i < opts->wadtextures; ++i)
+    {
+        lumps[i].filepos = (int32_t)gen_miptex (&wad, i, opts->wadsize);
+        lumps[i].disksize = lumps[i].size = (int32_t)(wad.size - lumps[i].filepos);
+        lumps[i].type = TYP_MIPTEX;
+        lumps[i].compression = CMP_NONE;
+        memcpy (lumps[i].name, ((miptex_t *)gen_at (&wad, lumps[i].filepos))->name, sizeof (lumps[i].name));
+    }
+
+    header.id = IDWADHEADER;
+    header.numlumps = opts->wadtextures;
+    header.infotableofs = (int32_t)gen_add (&wad, lumps, opts->wadtextures * sizeof (*lumps));
+    memcpy (gen_at (&wad, 0), &header, sizeof (header));
+
+    free (lumps);
+
+    gen_save (&wad, dir, opts->name, ".wad");
+}
+
+/* Only the texture lump, it's all decompmdl reads. */
+static void gen_bsp (const genoptions_t *opts, const char *dir)
+{
+    genbuf_t bsp = {NULL, 0, 0};
+    dheader_t header;
+    int32_t count = opts->wadtextures;
+    int i;
+
+    memset (&header, 0, sizeof (header));
+    header.version = BSPVERSION;
+
+    gen_reserve (&bsp, sizeof (header));
+
+    size_t lump = gen_add (&bsp, &count, sizeof (count));
+    size_t offsets = gen_reserve (&bsp, count * sizeof (int32_t));
+
+    for (i = 0; i < count; ++i)
+    {
+        int32_t ofs = (int32_t)(gen_miptex (&bsp, i, opts->wadsize) - lump);
+        memcpy (gen_at (&bsp, offsets + i * sizeof (ofs)), &ofs, sizeof (ofs));
+    }
+
+    header.lumps[LUMP_TEXTURES].fileofs = (int32_t)lump;
+    header.lumps[LUMP_TEXTURES].filelen = (int32_t)(bsp.size - lump);
+    memcpy (gen_at (&bsp, 0), &header, sizeof (header));
+
+    gen_save (&bsp, dir, opts->name, ".bsp");
+}
+
+static void gen_help (void)
+{
+    fprintf (stdout, "Usage: decompgen [options...] <output directory>\n\n");
+    fprintf (stdout, "Writes <name>.mdl, .spr, .wad & .bsp, the same for the same options.\n\n");
+    fprintf (stdout, "Options:\n");
+    fprintf (stdout, "\t-seed <n>\t\tDefaults to 1.\n");
+    fprintf (stdout, "\t-name <name>\t\tDefaults to \"bench\".\n");
+    fprintf (stdout, "\t-bones <n>\t\tModel bones, defaults to 48.\n");
+    fprintf (stdout, "\t-sequences <n>\t\tDefaults to 40, some of them blends.\n");
+    fprintf (stdout, "\t-frames <n>\t\tPer sequence, defaults to 60.\n");
+    fprintf (stdout, "\t-models <n>\t\tIn the bodypart, defaults to 2.\n");
+    fprintf (stdout, "\t-meshes <n>\t\tPer model, defaults to 8.\n");
+    fprintf (stdout, "\t-triangles <n>\t\tPer mesh, defaults to 250.\n");
+    fprintf (stdout, "\t-textures <n>\t\tModel textures, defaults to 8.\n");
+    fprintf (stdout, "\t-texsize <n>\t\tModel texture width, defaults to 256.\n");
+    fprintf (stdout, "\t-seqgroups <n>\t\tSequence groups, the first in the model, defaults to 1.\n");
+    fprintf (stdout, "\t-texturefile\t\tPut the model's textures in <name>t.mdl.\n");
+    fprintf (stdout, "\t-sprframes <n>\t\tSprite frames, up to %i, defaults to 200.\n", SPR_MAX_FRAMES);
+    fprintf (stdout, "\t-sprsize <n>\t\tLargest sprite frame, defaults to 128.\n");
+    fprintf (stdout, "\t-wadtextures <n>\tWAD & BSP textures, defaults to 64.\n");
+    fprintf (stdout, "\t-wadsize <n>\t\tWAD & BSP texture width, defaults to 256.\n");
+    exit (0);
+}
+
+static int gen_getint (int argc, char **argv, int *i, int min, int max)
+{
+    if (*i + 1 >= argc)
+        error (1, "No value for \"%s\"\n", argv[*i]);
+
+    int value = atoi (argv[++*i]);
+
+    if (value < min || value > max)
+        error (1, "\"%s\" must be %i to %i\n", argv[*i - 1], min, max);
+
+    return value;
+}
+
+int main (int argc, char **argv)
+{
+    genoptions_t opts = {1, "bench", 48, 40, 60, 2, 8, 250, 8, 256, 1, false, 200, 128, 64, 256};
+    int i;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (argv[i][0] != '-')
+            break;
+
+        if (!strcmp (argv[i], "-help"))
+            gen_help ();
+        else if (!strcmp (argv[i], "-seed"))
+            opts.seed = gen_getint (argc, argv, &i, 0, 0x7FFFFFFF);
+        else if (!strcmp (argv[i], "-name") && i + 1 < argc)
+            opts.name = argv[++i];
+        else if (!strcmp (argv[i], "-bones"))
+            opts.bones = gen_getint (argc, argv, &i, 1, MAXSTUDIOBONES);
+        else if (!strcmp (argv[i], "-sequences"))
+            opts.sequences = gen_getint (argc, argv, &i, 1, MAXSTUDIOSEQUENCES);
+        else if (!strcmp (argv[i], "-frames"))
+            opts.frames = gen_getint (argc, argv, &i, 1, 100000);
+        else if (!strcmp (argv[i], "-models"))
+            opts.models = gen_getint (argc, argv, &i, 1, MAXSTUDIOMODELS);
+        else if (!strcmp (argv[i], "-meshes"))
+            opts.meshes = gen_getint (argc, argv, &i, 1, MAXSTUDIOMESHES);
+        else if (!strcmp (argv[i], "-triangles"))
+            opts.triangles = gen_getint (argc, argv, &i, 1, MAXSTUDIOTRIANGLES);
+        else if (!strcmp (argv[i], "-textures"))
+            opts.textures = gen_getint (argc, argv, &i, 1, MAXSTUDIOSKINS);
+        else if (!strcmp (argv[i], "-texsize"))
+            opts.texsize = gen_getint (argc, argv, &i, 2, 4096);
+        else if (!strcmp (argv[i], "-seqgroups"))
+            opts.seqgroups = gen_getint (argc, argv, &i, 1, 99);
+        else if (!strcmp (argv[i], "-texturefile"))
+            opts.texturefile = true;
+        else if (!strcmp (argv[i], "-sprframes"))
+            opts.sprframes = gen_getint (argc, argv, &i, 1, SPR_MAX_FRAMES);
+        else if (!strcmp (argv[i], "-sprsize"))
+            opts.sprsize = gen_getint (argc, argv, &i, 2, 4096);
+        else if (!strcmp (argv[i], "-wadtextures"))
+            opts.wadtextures = gen_getint (argc, argv, &i, 1, MAX_MAP_TEXTURES);
+        else if (!strcmp (argv[i], "-wadsize"))
+            opts.wadsize = gen_getint (argc, argv, &i, 16, 4096);
+        else
+            error (1, "Unknown option: \"%s\"\n", argv[i]);
+    }
+
+    if (i != argc - 1)
+        gen_help ();
+
+    /* Mip levels down to 1/8 of the size. */
+    opts.wadsize &= ~15;
+
+    gen_state = opts.seed;
+
+    gen_mdl (&opts, argv[i]);
+    gen_spr (&opts, argv[i]);
+    gen_wad (&opts, argv[i]);
+    gen_bsp (&opts, argv[i]);
+
+    return 0;
+}